@@ -1,12 +1,19 @@
 /*
  * cachelab.c - Cache Lab helper functions
  */
+#define _DEFAULT_SOURCE
+
 #include "cachelab.h"
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <time.h>
 
+/* Huge pages are 2MB */
+#define HUGE_PAGE_SIZE (1 << 21)
+
 trans_func_t func_list[MAX_TRANS_FUNCS];
 int func_counter = 0;
 
@@ -48,6 +55,54 @@ void randMatrix(int M, int N, int A[N][M]) {
     }
 }
 
+/*
+ * allocMatrix - Allocate a zeroed matrix of M x N ints with mmap, so that
+ *     it starts on a page of its own. If huge is set, the matrix is backed
+ *     by the reserved huge pages of the system if there are any, and asks
+ *     for transparent huge pages otherwise.
+ */
+void *allocMatrix(int M, int N, int huge) {
+    size_t bytes = matrixSize(M, N, huge);
+    void *matrix = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (huge)
+        matrix = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (matrix == MAP_FAILED) {
+        matrix = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+        if (huge && matrix != MAP_FAILED)
+            madvise(matrix, bytes, MADV_HUGEPAGE);
+#endif
+    }
+    if (matrix == MAP_FAILED) {
+        printf("Error: allocation of a %dx%d matrix failed\n", M, N);
+        exit(1);
+    }
+    return matrix;
+}
+
+/*
+ * freeMatrix - Free a matrix of allocMatrix()
+ */
+void freeMatrix(void *matrix, int M, int N, int huge) {
+    munmap(matrix, matrixSize(M, N, huge));
+}
+
+/*
+ * matrixSize - The number of bytes allocMatrix() maps for a matrix
+ */
+size_t matrixSize(int M, int N, int huge) {
+    size_t bytes = (size_t) M * N * sizeof(int);
+
+    if (huge)
+        bytes = (bytes + HUGE_PAGE_SIZE - 1) & ~(size_t) (HUGE_PAGE_SIZE - 1);
+    return bytes;
+}
+
 /*
  * correctTrans - baseline transpose function used to evaluate correctness
  */
@@ -70,8 +125,29 @@ void registerTransFunction(void (*trans)(int M, int N, int[N][M], int[M][N]),
     func_list[func_counter].func_ptr = trans;
     func_list[func_counter].description = desc;
     func_list[func_counter].correct = 0;
+    func_list[func_counter].in_place = 0;
     func_list[func_counter].num_hits = 0;
     func_list[func_counter].num_misses = 0;
     func_list[func_counter].num_evictions = 0;
     func_counter++;
 }
+
+/*
+ * registerInPlaceFunction - Add the given in-place trans function into
+ *     your list of functions to be tested. An in-place function is called
+ *     with B holding the N x M matrix A, and must leave its M x N
+ *     transpose there without touching A.
+ */
+void registerInPlaceFunction(void (*trans)(int M, int N, int[N][M],
+                                           int[M][N]),
+                             char *desc) {
+    registerTransFunction(trans, desc);
+    func_list[func_counter - 1].in_place = 1;
+}
+
+/*
+ * prepareInPlace - Copy A into B, where an in-place function transposes it
+ */
+void prepareInPlace(int M, int N, int A[N][M], int B[M][N]) {
+    memcpy(B, A, (size_t) M * N * sizeof(int));
+}
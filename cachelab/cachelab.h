@@ -5,12 +5,15 @@
 #ifndef CACHELAB_TOOLS_H
 #define CACHELAB_TOOLS_H
 
+#include <stddef.h>
+
 #define MAX_TRANS_FUNCS 100
 
 typedef struct trans_func {
     void (*func_ptr)(int M, int N, int[N][M], int[M][N]);
     char *description;
     char correct;
+    char in_place; /* does it transpose B in place rather than A into B? */
     unsigned int num_hits;
     unsigned int num_misses;
     unsigned int num_evictions;
@@ -27,6 +30,15 @@ void printSummary(int hits,       /* number of  hits */
 /* Fill the matrix with data */
 void initMatrix(int M, int N, int A[N][M], int B[M][N]);
 
+/* Allocate a zeroed matrix on pages of its own, huge ones if huge is set */
+void *allocMatrix(int M, int N, int huge);
+
+/* Free a matrix of allocMatrix() */
+void freeMatrix(void *matrix, int M, int N, int huge);
+
+/* The number of bytes allocMatrix() maps for a matrix */
+size_t matrixSize(int M, int N, int huge);
+
 /* The baseline trans function that produces correct results. */
 void correctTrans(int M, int N, int A[N][M], int B[M][N]);
 
@@ -34,4 +46,12 @@ void correctTrans(int M, int N, int A[N][M], int B[M][N]);
 void registerTransFunction(void (*trans)(int M, int N, int[N][M], int[M][N]),
                            char *desc);
 
+/* Add the given in-place function to the function list */
+void registerInPlaceFunction(void (*trans)(int M, int N, int[N][M],
+                                           int[M][N]),
+                             char *desc);
+
+/* Copy A into B for an in-place function to transpose there */
+void prepareInPlace(int M, int N, int A[N][M], int B[M][N]);
+
 #endif /* CACHELAB_TOOLS_H */
@@ -1,13 +1,32 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 #include <assert.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(CSIM_PROFILE) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
 
 #include "cachelab.h"
+#include "csim.h"
+#include "tracefmt.h"
 
 typedef struct {
     char type;     // Type of a memory access.
@@ -15,15 +34,178 @@ typedef struct {
     size_t size;   // Size of a memory access.
 } access_t;
 
+/* A trace being read, either from a file or from memory. */
+typedef struct {
+    FILE *file;                     // The trace file, or NULL if mapped.
+    const char *data;               // The mapped trace, or NULL if a file.
+    size_t length;                  // Size of `data`.
+    size_t at;                      // Offset of the next byte in `data`.
+    bool binary;                    // Is the trace a binary trace?
+    bool runs;                      // Is the trace a run-length trace?
+    run_record_t group[RUN_MAX_LANES]; // The rest of the current group of
+                                       // interleaved runs, or of the run.
+    size_t lanes;                   // The number of runs in `group`.
+    size_t lane;                    // The run the next access comes from.
+    trace_record_t records[4096];   // Buffer of records of a binary trace.
+    size_t count;                   // The number of records in `records`.
+    size_t next;                    // The next record to read in `records`.
+    bool open;                      // Has the start marker been read?
+    bool ended;                     // Has the end marker been read?
+} reader_t;
+
+/* The cache. The entries of the victim cache, if any, are kept as extra lines
+ * after the lines of the sets, with the block address (tag and set index) in
+ * place of the tag and ranks among the victim entries only. */
 typedef struct {
     size_t size;     // Total number of lines in a cache.
+    size_t victims;  // The number of victim cache entries.
     bool *valid;     // Array of valid bits.
+    bool *dirty;     // Array of dirty bits, set by stores to the line.
     uint64_t *tags;  // Array of tags.
     uint64_t *ranks; // Array of ranks to be used for LRU replacement policy.
+    uint64_t *sectorValid; // Array of sector valid bits, or NULL if the cache
+                           // is not sectored.
+    uint64_t *sectorDirty; // Array of sector dirty bits, or NULL likewise.
+    void *storage;   // Memory block holding the arrays above.
+    size_t mapped;   // Size of `storage` if it is a mapped snapshot, else 0.
 } cache_t;
 
+/* Set index functions. */
+enum {
+    INDEX_BITS,  // The set index bits of the address.
+    INDEX_XOR,   // XOR of all the s-bit chunks of the block address.
+    INDEX_PRIME, // The block address modulo the number of sets.
+    INDEX_SKEW   // A different hash of the block address for each way.
+};
+
+/* Page allocators of the translation of virtual addresses. */
+enum {
+    PAGES_IDENTITY, // No translation.
+    PAGES_RANDOM,   // A random frame for each 4KB page.
+    PAGES_COLOR,    // A random frame of the same color as each 4KB page.
+    PAGES_HUGE      // A random frame for each 2MB page.
+};
+
+/* The outcome of a memory access. */
+typedef struct {
+    int hit;        // The number of hits; a modify access can hit twice.
+    bool miss;      // Did the access miss?
+    bool evict;     // Did the access evict a line out of the cache?
+    bool victimHit; // Did the access miss the sets but hit the victim cache?
+    bool sectorMiss; // Did the access hit the tag but miss a sector?
+    bool writeback;   // Was the evicted line dirty?
+    uint64_t evicted; // Block address of the evicted line, if any.
+} outcome_t;
+
+/* A miss status holding register of the timing model. */
+typedef struct {
+    uint64_t block; // Block address of the outstanding miss.
+    uint64_t done;  // Cycle at which the miss completes.
+} mshr_t;
+
+/* Header of a cache state snapshot. It is followed by the tags, ranks and
+ * valid bits of the cache, laid out exactly as `storage` of `cache_t`, so that
+ * a snapshot can be mapped and used in place. */
+typedef struct {
+    char magic[8];       // Always `snapshotMagic`.
+    uint32_t version;    // Always `snapshotVersion`.
+    uint32_t indexBits;  // The number of set index bits (s).
+    uint32_t offsetBits; // The number of block bits (b).
+    uint32_t victims;    // The number of victim cache entries.
+    uint32_t indexing;   // The set index function.
+    uint32_t sectors;    // The number of sectors per line, or 0.
+    uint64_t sets;       // The number of sets.
+    uint64_t assoc;      // Associativity (E).
+    uint64_t position;   // The number of trace accesses consumed so far.
+    uint64_t hits;       // The number of hits so far.
+    uint64_t misses;     // The number of misses so far.
+    uint64_t evictions;  // The number of evictions so far.
+    uint64_t victimHits; // The number of victim cache hits so far.
+    uint64_t useClock;   // The use clock of a skewed cache.
+    uint64_t sectorMisses; // The number of sector misses so far.
+    uint64_t bytesFetched; // The number of bytes fetched so far.
+    uint64_t bytesWritten; // The number of bytes written back so far.
+    uint32_t roiOpen;      // Has the start marker been read?
+    uint32_t roiEnded;     // Has the end marker been read?
+    uint64_t traceSize;    // Size of the trace in bytes, or 0 if unknown.
+    uint64_t warmup;       // The accesses (or bytes) left to warm up with.
+    uint32_t warmupBytes;  // Is `warmup` measured in bytes?
+    uint32_t pad;          // Padding; always zero.
+    uint64_t interval;     // Accesses per window, or 0 if disabled.
+    uint64_t windows;      // The number of windows written so far.
+    uint64_t windowAccesses;  // The number of accesses in the open window.
+    uint64_t windowHits;      // The number of hits in the open window.
+    uint64_t windowMisses;    // The number of misses in the open window.
+    uint64_t windowEvictions; // The number of evictions in the open window.
+} snapshot_t;
+
+/* Statistics of a group of accesses, such as the accesses of one type or the
+ * accesses that map to one set. */
+typedef struct {
+    uint64_t accesses;  // The number of accesses.
+    uint64_t hits;      // The number of hits.
+    uint64_t misses;    // The number of misses.
+    uint64_t evictions; // The number of evictions.
+    uint64_t victimHits; // The number of victim cache hits.
+} counter_t;
+
+/* A tenant of a shared cache, which replays its own trace. */
+typedef struct {
+    char *path;              // Name of the trace.
+    reader_t reader;         // The trace.
+    uint64_t mask;           // Ways the tenant may allocate into.
+    bool done;               // Has the trace ended?
+    counter_t stats;         // Statistics of the accesses of the tenant.
+    uint64_t crossEvictions; // Lines of the tenant evicted by other tenants.
+} tenant_t;
+
+/* The result of a job of a batch, in memory shared with the workers. */
+typedef struct {
+    bool done;       // Did the job complete?
+    counter_t stats; // Statistics of the job.
+} job_t;
+
+/* An entry of the hash table of the page mapping. */
+typedef struct {
+    uint64_t page;  // Virtual page number.
+    uint64_t frame; // Physical frame number of the page.
+    bool used;      // Is the entry occupied?
+} page_t;
+
+/* An entry of the hash table of per-region statistics. */
+typedef struct {
+    uint64_t region; // Region number, i.e. the address shifted by `regionBits`.
+    bool used;       // Is the entry occupied?
+    counter_t stats; // Statistics of the accesses to the region.
+} region_t;
+
+/* Phases of the simulation distinguished by the profiler. */
+enum {
+    PHASE_READ,    // Reading the trace.
+    PHASE_PARSE,   // Parsing an access.
+    PHASE_PROBE,   // Looking up the set for a hit.
+    PHASE_REPLACE, // Updating the replacement state.
+    PHASE_STATS,   // Updating the statistics.
+    PHASE_OTHER,   // Everything else, such as printing diagnostics.
+    PHASES
+};
+
+/* The profiler charges the time since the previous mark to `phase`. It compiles
+ * to nothing unless csim is built with CSIM_PROFILE. */
+#ifdef CSIM_PROFILE
+#define PROFILE_MARK(phase) markPhase(phase)
+#else
+#define PROFILE_MARK(phase)
+#endif
+
+static const char snapshotMagic[8] = "CSIMSNAP";
+static const uint32_t snapshotVersion = 8;
+
 static const char usage[] =
-    "Usage: %s [-hvdc] -s <s> -E <E> -b <b> -t <tracefile>\n"
+    "Usage: %s [-hvdc] -s <s> -E <E> -b <b> -t <tracefile> [options]\n"
+    "       %s [-hvdc] -s <s> -E <E> -b <b> --tenant <tracefile>[:<mask>] "
+    "...\n"
+    "       %s --batch <configfile> [--workers <n>] <tracefile>...\n"
     "Options:\n"
     "   -h             Display this usage info and quit.\n"
     "   -v             Optional flag that displays trace info.\n"
@@ -33,318 +215,3028 @@ static const char usage[] =
     "sets).\n"
     "   -E <E>         Associativity (number of lines per set).\n"
     "   -b <b>         Number of block bits (B = 2^b is the block size).\n"
-    "   -t <tracefile> Name of the valgrind trace to replay.\n";
+    "   -t <tracefile> Name of the valgrind, binary or run-length trace to\n"
+    "                  replay.\n"
+    "   -o <offset>    Number of trace accesses to skip before simulating.\n"
+    "   --save-state <file>\n"
+    "                  Save the cache state to <file> after the simulation.\n"
+    "   --load-state <file>\n"
+    "                  Start from the cache state saved in <file>. -s, -E and\n"
+    "                  -b may be omitted, and the trace is resumed where the\n"
+    "                  saved simulation stopped unless -o is given. Resuming\n"
+    "                  requires the trace the state was saved on; with -o,\n"
+    "                  any trace may start from the state. A warm-up or an\n"
+    "                  interval window left open is resumed too.\n"
+    "   --warmup <n>[B]\n"
+    "                  Simulate the first <n> accesses (or <n> bytes if\n"
+    "                  suffixed with B) without counting statistics.\n"
+    "   --interval <k> Print hits, misses and evictions of every window of\n"
+    "                  <k> accesses as CSV to stderr, apart from the summary\n"
+    "                  on stdout.\n"
+    "   --interval-file <file>\n"
+    "                  Write the interval CSV to <file> instead of stderr.\n"
+    "   --stats <file> Write statistics broken down by access type and by set\n"
+    "                  into <file> at exit. Excludes --load-state.\n"
+    "   --stats-format <json|csv>\n"
+    "                  Format of the statistics file. Defaults to csv if the\n"
+    "                  file name ends with .csv, json otherwise.\n"
+    "   --region-stats Also break the statistics down by 4KB region.\n"
+    "   --victim <n>   Add a fully-associative victim cache of <n> lines.\n"
+    "   --index <bits|xor|prime|skew>\n"
+    "                  Set index function: the set index bits (default), XOR\n"
+    "                  of all s-bit chunks of the block address, the block\n"
+    "                  address modulo a prime number of sets, or a different\n"
+    "                  hash for each way (skewed-associative).\n"
+    "   --sets <n>     Number of sets for --index prime. Defaults to the\n"
+    "                  largest prime not above 2^s.\n"
+    "   --sectors <n>  Split each line into <n> sectors with their own valid\n"
+    "                  and dirty bits, fetching only the missing sectors.\n"
+    "   --tenant <tracefile>[:<mask>]\n"
+    "                  Replay <tracefile> as one of the tenants sharing the\n"
+    "                  cache instead of -t. May be repeated. The optional\n"
+    "                  hexadecimal way mask limits the ways the tenant\n"
+    "                  allocates into; it still hits in any way. Addresses of\n"
+    "                  the n-th tenant are tagged with n from bit 56 up.\n"
+    "   --quantum <n>  Accesses each tenant replays in turn (default 1000).\n"
+    "   --start-marker <addr>\n"
+    "                  Skip the accesses before the first access to the\n"
+    "                  hexadecimal address <addr>.\n"
+    "   --end-marker <addr>\n"
+    "                  End the trace after the first access to <addr>.\n"
+    "   --include <low>-<high>\n"
+    "                  Only simulate accesses from the hexadecimal address\n"
+    "                  <low> up to but not including <high>. May be repeated.\n"
+    "   --exclude <low>-<high>\n"
+    "                  Skip the accesses within the range. May be repeated.\n"
+    "   --types <types>\n"
+    "                  Only simulate the accesses of the given types, such as\n"
+    "                  LS. The filters above don't change the trace position.\n"
+    "   --batch <configfile>\n"
+    "                  Simulate every trace with every configuration, one\n"
+    "                  line of options in <configfile> each, and print a CSV\n"
+    "                  table of the results in the order of the traces and\n"
+    "                  the configurations.\n"
+    "   --workers <n>  Number of jobs of a batch run at once (default the\n"
+    "                  number of processors).\n"
+    "   --miss-stream <file>\n"
+    "                  Write the misses and writebacks as a trace into\n"
+    "                  <file>, each miss as a load of its block and each\n"
+    "                  eviction of a dirty line as a store of its block, for\n"
+    "                  a simulation of the next level.\n"
+    "                  With --page-trials or --batch, each trial or job\n"
+    "                  writes <file>.<seed> or <file>.<job> instead.\n"
+    "   --miss-stream-format <text|binary>\n"
+    "                  Format of the miss stream (default text).\n"
+    "   --miss-stream-victims\n"
+    "                  Also write each evicted block, clean or dirty, as a V\n"
+    "                  record before the miss that evicted it. Trace readers\n"
+    "                  skip V records, as they are not accesses. Requires\n"
+    "                  the text format.\n"
+    "   --pages <identity|random|color|huge>\n"
+    "                  Translate the addresses before indexing the cache by\n"
+    "                  allocating each page a physical frame: the same as the\n"
+    "                  page (the default), a random 4KB frame, a random 4KB\n"
+    "                  frame of the same cache color, or a random 2MB frame.\n"
+    "   --page-seed <n>\n"
+    "                  Seed of the page allocator (default 1).\n"
+    "   --page-trials <n>\n"
+    "                  Simulate <n> allocations with successive seeds and\n"
+    "                  report how the misses vary among them.\n"
+    "   --timing       Estimate cycles, AMAT and MSHR occupancy with an\n"
+    "                  in-order issue model of one access per cycle.\n"
+    "   --hit-latency <n>\n"
+    "                  Cycles of a hit (default 1).\n"
+    "   --victim-latency <n>\n"
+    "                  Cycles of a victim cache hit (default 3).\n"
+    "   --memory-latency <n>\n"
+    "                  Cycles of a miss served by memory (default 100).\n"
+    "   --mshrs <n>    Number of outstanding misses (default 8).\n"
+    "   --bandwidth <n>\n"
+    "                  Memory bandwidth in bytes per cycle (default\n"
+    "                  unlimited).\n"
+    "   --profile      Print the time spent in each phase of the simulation.\n"
+    "                  Requires csim to be built with CSIM_PROFILE.\n";
+
+enum {
+    OPT_SAVE_STATE = 256,
+    OPT_LOAD_STATE,
+    OPT_WARMUP,
+    OPT_INTERVAL,
+    OPT_INTERVAL_FILE,
+    OPT_STATS,
+    OPT_STATS_FORMAT,
+    OPT_REGION_STATS,
+    OPT_PROFILE,
+    OPT_VICTIM,
+    OPT_INDEX,
+    OPT_SETS,
+    OPT_TIMING,
+    OPT_HIT_LATENCY,
+    OPT_VICTIM_LATENCY,
+    OPT_MEMORY_LATENCY,
+    OPT_MSHRS,
+    OPT_BANDWIDTH,
+    OPT_SECTORS,
+    OPT_TENANT,
+    OPT_QUANTUM,
+    OPT_START_MARKER,
+    OPT_END_MARKER,
+    OPT_INCLUDE,
+    OPT_EXCLUDE,
+    OPT_TYPES,
+    OPT_BATCH,
+    OPT_WORKERS,
+    OPT_MISS_STREAM,
+    OPT_MISS_STREAM_FORMAT,
+    OPT_MISS_STREAM_VICTIMS,
+    OPT_PAGES,
+    OPT_PAGE_SEED,
+    OPT_PAGE_TRIALS
+};
+
+static const struct option longOptions[] = {
+    {"save-state", required_argument, NULL, OPT_SAVE_STATE},
+    {"load-state", required_argument, NULL, OPT_LOAD_STATE},
+    {"warmup", required_argument, NULL, OPT_WARMUP},
+    {"interval", required_argument, NULL, OPT_INTERVAL},
+    {"interval-file", required_argument, NULL, OPT_INTERVAL_FILE},
+    {"stats", required_argument, NULL, OPT_STATS},
+    {"stats-format", required_argument, NULL, OPT_STATS_FORMAT},
+    {"region-stats", no_argument, NULL, OPT_REGION_STATS},
+    {"profile", no_argument, NULL, OPT_PROFILE},
+    {"victim", required_argument, NULL, OPT_VICTIM},
+    {"index", required_argument, NULL, OPT_INDEX},
+    {"sets", required_argument, NULL, OPT_SETS},
+    {"timing", no_argument, NULL, OPT_TIMING},
+    {"hit-latency", required_argument, NULL, OPT_HIT_LATENCY},
+    {"victim-latency", required_argument, NULL, OPT_VICTIM_LATENCY},
+    {"memory-latency", required_argument, NULL, OPT_MEMORY_LATENCY},
+    {"mshrs", required_argument, NULL, OPT_MSHRS},
+    {"bandwidth", required_argument, NULL, OPT_BANDWIDTH},
+    {"sectors", required_argument, NULL, OPT_SECTORS},
+    {"tenant", required_argument, NULL, OPT_TENANT},
+    {"quantum", required_argument, NULL, OPT_QUANTUM},
+    {"start-marker", required_argument, NULL, OPT_START_MARKER},
+    {"end-marker", required_argument, NULL, OPT_END_MARKER},
+    {"include", required_argument, NULL, OPT_INCLUDE},
+    {"exclude", required_argument, NULL, OPT_EXCLUDE},
+    {"types", required_argument, NULL, OPT_TYPES},
+    {"batch", required_argument, NULL, OPT_BATCH},
+    {"workers", required_argument, NULL, OPT_WORKERS},
+    {"miss-stream", required_argument, NULL, OPT_MISS_STREAM},
+    {"miss-stream-format", required_argument, NULL, OPT_MISS_STREAM_FORMAT},
+    {"miss-stream-victims", no_argument, NULL, OPT_MISS_STREAM_VICTIMS},
+    {"pages", required_argument, NULL, OPT_PAGES},
+    {"page-seed", required_argument, NULL, OPT_PAGE_SEED},
+    {"page-trials", required_argument, NULL, OPT_PAGE_TRIALS},
+    {NULL, 0, NULL, 0}};
 
 static bool verbose = false;     // Should the simulator run verbosely?
 static bool diagnostics = false; // Should the simulator print diagnostics?
 static bool state = false;       // Should the simulator print cache status?
-static FILE *tracefile = NULL;   // The file to trace.
+static char *tracePath = NULL;   // Name of the trace given by -t.
+static reader_t mainTrace;       // The trace given by -t.
+static reader_t *trace = NULL;   // The trace being replayed.
 static size_t assoc;             // Associativity of the cache (E).
 static size_t offsetBits; // The number of offset bits in the address (b).
 static size_t indexBits;  // The number of set index bits in the address (s).
-
-static int hits = 0;      // The number of hits.
-static int misses = 0;    // The number of misses.
-static int evictions = 0; // The number of evictions.
-
+static size_t victims = 0; // The number of victim cache entries.
+static int indexing = INDEX_BITS; // The set index function.
+static size_t sets = 0;           // The number of sets.
+static uint64_t useClock = 0;     // Use clock for ranks of a skewed cache.
+static uint64_t recentLine = 0;   // The line of the latest access.
+static size_t sectors = 0;        // Sectors per line, or 0 if not sectored.
+
+static bool startMarked = false; // Is there a start marker?
+static uint64_t startMarker;     // Address of the start marker.
+static bool endMarked = false;   // Is there an end marker?
+static uint64_t endMarker;       // Address of the end marker.
+static range_t *includes = NULL; // Ranges of the accesses to simulate.
+static size_t includeCount = 0;  // The number of ranges in `includes`.
+static range_t *excludes = NULL; // Ranges of the accesses to skip.
+static size_t excludeCount = 0;  // The number of ranges in `excludes`.
+static bool typeKept[3] = {true, true, true}; // Types to simulate, indexed
+                                              // by `getTypeIndex`.
+
+static char *batchPath = NULL; // The configurations of a batch, if any.
+static long workers = 0;       // Jobs of a batch run at once, or 0 if auto.
+static char **batchConfigs = NULL;    // The configurations of the batch.
+static size_t batchConfigCount = 0;   // The number of configurations.
+static reader_t *batchReaders = NULL; // The mapped traces of the batch.
+
+static int pages = PAGES_IDENTITY; // The page allocator.
+static uint64_t pageSeed = 1;      // Seed of the page allocator.
+static uint64_t pageTrials = 0;    // Allocations to compare, or 0 if none.
+static page_t *pageTable = NULL;   // Hash table of the page mapping.
+static size_t pageCapacity = 0;    // The number of entries of `pageTable`.
+static size_t pageCount = 0;       // The number of pages mapped so far.
+static const int pageBits = 12;     // Pages are 4KB,
+static const int hugePageBits = 21; // or 2MB if huge.
+static const int physicalBits = 36; // Physical memory is 64GB.
+
+static char *savePath = NULL; // The file to save the cache state into.
+static char *loadPath = NULL; // The file to load the cache state from.
+static int64_t offset = -1;   // Trace accesses to skip, or -1 if not given.
+static uint64_t position = 0; // The number of trace accesses consumed.
+
+static uint64_t warmup = 0;       // Accesses (or bytes) left to warm up with.
+static bool warmupBytes = false;  // Is `warmup` measured in bytes?
+static uint64_t interval = 0;     // Accesses per window, or 0 if disabled.
+static FILE *intervalfile = NULL; // The file to write the windows into.
+
+static char *statsPath = NULL; // The file to write the statistics into.
+static bool statsCSV = false;  // Is the statistics file CSV rather than JSON?
+static bool regionStats = false; // Should statistics be kept per region?
+static const size_t regionBits = 12; // Regions are 4KB.
+
+#ifdef CSIM_PROFILE
+static bool profile = false;         // Should the profile be printed?
+static uint64_t phaseTicks[PHASES];  // Ticks spent in each phase.
+static uint64_t profileStamp = 0;    // Ticks at the previous mark.
+static uint64_t profileFirst = 0;    // Trace position at the start.
+static struct timespec profileStart; // Wall clock time at the start.
+#endif
+
+static uint64_t hits = 0;         // The number of hits.
+static uint64_t misses = 0;       // The number of misses.
+static uint64_t evictions = 0;    // The number of evictions.
+static uint64_t victimHits = 0;   // The number of victim cache hits.
+static uint64_t sectorMisses = 0; // The number of sector misses.
+static uint64_t bytesFetched = 0; // The number of bytes fetched by misses.
+static uint64_t bytesWritten = 0; // The number of dirty bytes written back.
+
+static char *streamPath = NULL;     // The miss stream file, or NULL if none.
+static int64_t streamJob = -1;      // The number of the job or trial whose
+                                    // miss stream it is, or -1 if none.
+static FILE *streamfile = NULL;     // The file to write the misses into.
+static bool streamBinary = false;   // Is the miss stream a binary trace?
+static bool streamVictims = false;  // Should evicted blocks be written?
+static char *streamBuffers[2];      // The buffer being filled and the one
+                                    // being written.
+static size_t streamLengths[2];     // The number of bytes of each buffer.
+static int streamFill = 0;          // The buffer being filled.
+static int streamFull = -1;         // The buffer to write, or -1 if none.
+static bool streamClosing = false;  // Should the writer thread finish?
+static bool streamFailed = false;   // Did writing the miss stream fail?
+static pthread_t streamThread;      // The writer thread.
+static pthread_mutex_t streamLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t streamCond = PTHREAD_COND_INITIALIZER;
+static const size_t streamCapacity = 1 << 20; // Size of each buffer.
+
+static bool timing = false;          // Should the timing be estimated?
+static uint64_t hitLatency = 1;      // Cycles of a hit.
+static uint64_t victimLatency = 3;   // Cycles of a victim cache hit.
+static uint64_t memoryLatency = 100; // Cycles of a miss served by memory.
+static size_t mshrCount = 8;         // The number of MSHRs.
+static uint64_t bandwidth = 0;       // Bytes per cycle, or 0 if unlimited.
+
+static mshr_t *mshrs = NULL;        // The MSHRs.
+static uint64_t *occupancy = NULL;  // Cycles spent with each number of MSHRs
+                                    // busy, from 0 to `mshrCount`.
+static uint64_t cycle = 0;          // Cycle at which the next access issues.
+static uint64_t busFree = 0;        // Cycle at which the memory bus is free.
+static uint64_t histCycle = 0;      // Cycle up to which `occupancy` counts.
+static uint64_t finishCycle = 0;    // Cycle at which all accesses complete.
+static uint64_t startCycle = 0;     // Cycle of the first counted access.
+static uint64_t latencies = 0;      // Total latency of counted accesses.
+static uint64_t timedAccesses = 0;  // The number of counted accesses.
+static uint64_t mergedMisses = 0;   // Accesses merged into an MSHR.
+static uint64_t stallCycles = 0;    // Cycles stalled for a free MSHR.
+
+static uint64_t windows = 0;        // The number of windows written so far.
+static uint64_t windowAccesses = 0; // The number of accesses in the window.
+static uint64_t windowHits = 0;     // The number of hits in the window.
+static uint64_t windowMisses = 0;   // The number of misses in the window.
+static uint64_t windowEvictions = 0; // The number of evictions in the window.
+
+static tenant_t *tenants = NULL; // Tenants sharing the cache, if any.
+static size_t tenantCount = 0;   // The number of tenants.
+static size_t tenant = 0;        // The tenant whose access is simulated.
+static uint64_t quantum = 1000;  // Accesses per time slice of a tenant.
+static uint64_t wayMask = UINT64_MAX; // Ways the current access may allocate
+                                      // into; way 64 and up always may.
+static const int tenantShift = 56;    // Tenant tag position in an address.
+
+static cache_t *libraryCache = NULL; // The cache fed by csimAccess().
+
+static counter_t typeStats[3];     // Statistics of loads, stores and modifies.
+static counter_t *setStats = NULL; // Statistics of each set.
+static region_t *regions = NULL;   // Hash table of per-region statistics.
+static size_t regionCapacity = 0;  // The number of entries of `regions`.
+static size_t regionCount = 0;     // The number of occupied entries.
+
+static void printUsage(char prog[]);
 static int getArg(char arg[], char prog[]);
+static int clampCount(uint64_t count);
+static int64_t getCountArg(char arg[], char prog[]);
+static void getWarmupArg(char prog[]);
 static void initTrace(int argc, char *argv[]);
 static void finalizeTrace();
+static void openTrace(reader_t *reader, char path[]);
+static void mapTrace(reader_t *reader, char path[]);
+static void attachTrace(reader_t *reader, const char *data, size_t length);
+static void replayTrace(uint64_t start, uint64_t end, const range_t ranges[],
+                        size_t count);
+static char *readLine(char buf[], int size);
+static void addTenant(char arg[]);
 static int parseAccess(char line[], access_t *dst);
+static uint64_t getAddressArg(char arg[], char text[], char **end);
+static void addRange(range_t **ranges, size_t *count, char arg[]);
+static void getTypesArg(char prog[]);
+static bool readAccess(access_t *dst);
+static bool readRun(run_record_t *dst);
+static bool nextRun();
+static bool nextAccess(access_t *dst);
+static bool keepAccess(access_t *access);
+static bool inRanges(range_t ranges[], size_t count, uint64_t addr);
+static uint64_t translate(uint64_t addr);
+static page_t *findPage(uint64_t page);
+static uint64_t permute(uint64_t n, int bits);
+static void skipAccesses(uint64_t count);
 static void runSimulation();
+static bool canFastForward();
+static void fastForward(cache_t *cache, access_t *last);
+static void runBatch(char *paths[], size_t traceCount);
+static char **readConfigs(size_t *count);
+static job_t *runJobs(size_t jobCount, void (*run)(size_t job));
+static void runPageTrials();
+static void runPageTrial(size_t job);
+static void runBatchJob(size_t job);
+static void runTenants(cache_t *cache);
+static void printTenants();
 static void processAccess(cache_t *cache, access_t *access);
 static inline uint64_t getIndex(uint64_t addr);
 static inline uint64_t getOffset(uint64_t addr);
 static inline uint64_t getTag(uint64_t addr);
-static void updateStat(int hit, bool miss, bool evict, access_t *access);
-static void updateRank(cache_t *cache, uint64_t index, uint64_t line);
-static uint64_t findLRULine(cache_t *cache, uint64_t index);
+static inline uint64_t getSkewedIndex(uint64_t block, size_t way);
+static inline uint64_t getLineBlock(uint64_t tag, uint64_t line);
+static size_t findPrime(size_t limit);
+static void updateStat(outcome_t *outcome, access_t *access);
+static void flushWindow();
+static inline int getTypeIndex(char type);
+static void countAccess(counter_t *counter, outcome_t *outcome);
+static counter_t *findRegion(uint64_t region);
+static void writeStats();
+#ifdef CSIM_PROFILE
+static inline uint64_t readTicks();
+static inline void markPhase(int phase);
+static void printProfile();
+#endif
+static void updateRank(cache_t *cache, uint64_t index, size_t ways,
+                       uint64_t line);
+static uint64_t findLRULine(cache_t *cache, uint64_t index, size_t ways);
+static uint64_t findPartitionLine(cache_t *cache, uint64_t index);
+static inline bool inPartition(size_t way);
+static bool findSkewedLine(cache_t *cache, uint64_t block, uint64_t *line);
+static inline void touchLine(cache_t *cache, uint64_t index, uint64_t line);
+static bool swapVictim(cache_t *cache, uint64_t line, uint64_t block,
+                       outcome_t *outcome);
+static bool fillSectors(cache_t *cache, uint64_t line, access_t *access);
+static void writeBack(cache_t *cache, uint64_t line);
+static void openStream();
+static void *writeStream(void *arg);
+static void emitRecord(char type, uint64_t block);
+static void flushStream();
+static void closeStream();
+static void makeTiming();
+static void timeAccess(outcome_t *outcome, access_t *access);
+static void advanceTime(uint64_t until);
+static void printTiming();
 static cache_t *makeCache();
+static size_t getLineBytes(bool sectored);
+static void layoutCache(cache_t *cache, void *arrays, size_t lines,
+                        bool sectored);
 static void destroyCache(cache_t *cache);
+static void saveState(cache_t *cache, char path[]);
+static cache_t *loadState(char path[]);
+static uint64_t getTraceSize();
 static void printCache(cache_t *cache);
-static void printAccess(int hit, bool miss, bool evict, access_t *access);
+static void printAccess(outcome_t *outcome, access_t *access);
+
+/* Built as a library, csim leaves main() to the program it is linked into. */
+#ifdef CSIM_LIBRARY
+#define main csimMain
+#endif
 
 int main(int argc, char *argv[]) {
     initTrace(argc, argv);
+
+    if (batchPath != NULL) {
+        runBatch(argv + optind, argc - optind);
+        return 0;
+    }
+
+    if (pageTrials > 0) {
+        runPageTrials();
+        return 0;
+    }
+
     runSimulation();
-    printSummary(hits, misses, evictions);
+    /* printSummary() and .csim_results hold ints, so the counts are clamped
+     * there, and printed in full on a line of their own if they had to be. */
+    printSummary(clampCount(hits), clampCount(misses), clampCount(evictions));
+    if (hits > INT_MAX || misses > INT_MAX || evictions > INT_MAX)
+        printf("full-counts hits:%" PRIu64 " misses:%" PRIu64
+               " evictions:%" PRIu64 "\n",
+               hits, misses, evictions);
+    if (victims > 0)
+        printf("victim-hits:%" PRIu64 "\n", victimHits);
+    if (sectors > 0)
+        printf("sector-misses:%" PRIu64 " line-misses:%" PRIu64
+               " bytes-fetched:%" PRIu64
+               " bytes-written:%" PRIu64 "\n",
+               sectorMisses, misses - sectorMisses, bytesFetched, bytesWritten);
+    if (tenantCount > 0)
+        printTenants();
+    if (timing)
+        printTiming();
+#ifdef CSIM_PROFILE
+    if (profile)
+        printProfile();
+#endif
     finalizeTrace();
 
     return 0;
 }
 
+/* Start a simulation fed by csimAccess() rather than a trace, of a cache with
+ * 2^s sets of E lines of 2^b bytes. The statistics of any previous simulation
+ * are cleared. */
+void csimBegin(int s, int E, int b) {
+    assert(libraryCache == NULL && s >= 0 && E > 0 && b >= 0);
+
+    indexBits = s;
+    assoc = E;
+    offsetBits = b;
+    sets = (size_t) 1 << indexBits;
+    hits = misses = evictions = 0;
+    useClock = 0;
+
+    libraryCache = makeCache();
+}
+
+/* Simulate an access of `type`, `addr` and `size` on the library cache. */
+void csimAccess(char type, uint64_t addr, size_t size) {
+    access_t access = {type, addr, size};
+
+    processAccess(libraryCache, &access);
+}
+
+/* Simulate on the cache of csimBegin() the trace of `length` bytes at `data`,
+ * in any format csim reads, from the access to `start` through the one to
+ * `end`, as replayTrace() does. */
+void csimReplay(const char *data, size_t length, uint64_t start, uint64_t end,
+                const range_t ranges[], size_t count) {
+    attachTrace(&mainTrace, data, length);
+    replayTrace(start, end, ranges, count);
+}
+
+/* Simulate on the cache of csimBegin() the valgrind trace read from `fp`, such
+ * as a pipe, as replayTrace() does. Reading stops at the end marker. */
+void csimReplayFile(FILE *fp, uint64_t start, uint64_t end,
+                    const range_t ranges[], size_t count) {
+    memset(&mainTrace, 0, sizeof(reader_t));
+    mainTrace.file = fp;
+    replayTrace(start, end, ranges, count);
+}
+
+/* Simulate the accesses of `mainTrace` on the cache of csimBegin(). Like the
+ * --start-marker, --end-marker and --include options do, only the accesses
+ * from the one to `start` through the one to `end` that are within any of the
+ * `count` ranges of `ranges` are simulated. */
+static void replayTrace(uint64_t start, uint64_t end, const range_t ranges[],
+                        size_t count) {
+    access_t access;
+
+    assert(libraryCache != NULL);
+
+    trace = &mainTrace;
+    startMarked = endMarked = true;
+    startMarker = start;
+    endMarker = end;
+    includes = (range_t *) ranges;
+    includeCount = count;
+
+    while (nextAccess(&access))
+        processAccess(libraryCache, &access);
+
+    trace = NULL;
+    startMarked = endMarked = false;
+    includes = NULL;
+    includeCount = 0;
+}
+
+/* Finish the simulation of csimBegin(), storing its statistics into `hitCount`,
+ * `missCount` and `evictionCount`. */
+void csimEnd(int *hitCount, int *missCount, int *evictionCount) {
+    *hitCount = clampCount(hits);
+    *missCount = clampCount(misses);
+    *evictionCount = clampCount(evictions);
+
+    destroyCache(libraryCache);
+    libraryCache = NULL;
+}
+
 /* Parse the command line arguments and initializes global variables. */
 static void initTrace(int argc, char *argv[]) {
-    if (argc < 8) {
-        printf(usage, argv[0]);
-        exit(-1);
-    }
-
-    char ch;
+    int ch;
+    bool geometry = false;
+    char *statsFormat = NULL;
 
-    while ((ch = getopt(argc, argv, "hvdcs:E:b:t:")) != -1) {
+    while ((ch = getopt_long(argc, argv, "hvdcs:E:b:t:o:", longOptions,
+                             NULL)) != -1) {
         switch (ch) {
         case 'h':
-            printf(usage, argv[0]);
+            printUsage(argv[0]);
             exit(0);
         case 'v':
             verbose = true;
             break;
         case 's':
             indexBits = getArg("s", argv[0]);
+            geometry = true;
             break;
         case 'E':
             assoc = getArg("E", argv[0]);
+            geometry = true;
             break;
         case 'b':
             offsetBits = getArg("b", argv[0]);
+            geometry = true;
             break;
         case 't':
-            if ((tracefile = fopen(optarg, "r")) == NULL) {
-                printf("Error: failed to open file %s\n", optarg);
-                exit(-1);
-            }
-
+            tracePath = optarg;
+            openTrace(&mainTrace, optarg);
+            trace = &mainTrace;
             break;
         case 'd':
             diagnostics = true;
             break;
         case 'c':
             state = true;
+            break;
+        case 'o':
+            offset = getCountArg("o", argv[0]);
+            break;
+        case OPT_SAVE_STATE:
+            savePath = optarg;
+            break;
+        case OPT_LOAD_STATE:
+            loadPath = optarg;
+            break;
+        case OPT_WARMUP:
+            getWarmupArg(argv[0]);
+            break;
+        case OPT_INTERVAL:
+            interval = getCountArg("interval", argv[0]);
+            break;
+        case OPT_STATS:
+            statsPath = optarg;
+            break;
+        case OPT_STATS_FORMAT:
+            if (strcmp(optarg, "json") != 0 && strcmp(optarg, "csv") != 0) {
+                printf("Error: invalid format of argument stats-format\n");
+                printUsage(argv[0]);
+                exit(-1);
+            }
+
+            statsFormat = optarg;
+            break;
+        case OPT_REGION_STATS:
+            regionStats = true;
+            break;
+        case OPT_VICTIM:
+            victims = getArg("victim", argv[0]);
+            break;
+        case OPT_INDEX:
+            if (strcmp(optarg, "bits") == 0)
+                indexing = INDEX_BITS;
+            else if (strcmp(optarg, "xor") == 0)
+                indexing = INDEX_XOR;
+            else if (strcmp(optarg, "prime") == 0)
+                indexing = INDEX_PRIME;
+            else if (strcmp(optarg, "skew") == 0)
+                indexing = INDEX_SKEW;
+            else {
+                printf("Error: unknown index function %s\n", optarg);
+                printUsage(argv[0]);
+                exit(-1);
+            }
+
+            geometry = true;
+            break;
+        case OPT_SETS:
+            sets = getArg("sets", argv[0]);
+            geometry = true;
+            break;
+        case OPT_SECTORS:
+            sectors = getArg("sectors", argv[0]);
+            geometry = true;
+            break;
+        case OPT_TENANT:
+            addTenant(optarg);
+            break;
+        case OPT_QUANTUM:
+            quantum = getCountArg("quantum", argv[0]);
+            break;
+        case OPT_START_MARKER:
+            startMarker = getAddressArg("start-marker", optarg, NULL);
+            startMarked = true;
+            break;
+        case OPT_END_MARKER:
+            endMarker = getAddressArg("end-marker", optarg, NULL);
+            endMarked = true;
+            break;
+        case OPT_INCLUDE:
+            addRange(&includes, &includeCount, optarg);
+            break;
+        case OPT_EXCLUDE:
+            addRange(&excludes, &excludeCount, optarg);
+            break;
+        case OPT_TYPES:
+            getTypesArg(argv[0]);
+            break;
+        case OPT_BATCH:
+            batchPath = optarg;
+            break;
+        case OPT_WORKERS:
+            workers = getArg("workers", argv[0]);
+            break;
+        case OPT_MISS_STREAM:
+            streamPath = optarg;
+            break;
+        case OPT_MISS_STREAM_FORMAT:
+            if (strcmp(optarg, "text") == 0)
+                streamBinary = false;
+            else if (strcmp(optarg, "binary") == 0)
+                streamBinary = true;
+            else {
+                printf("Error: invalid format of argument "
+                       "miss-stream-format\n");
+                printUsage(argv[0]);
+                exit(-1);
+            }
+
+            break;
+        case OPT_MISS_STREAM_VICTIMS:
+            streamVictims = true;
+            break;
+        case OPT_PAGES:
+            if (strcmp(optarg, "identity") == 0)
+                pages = PAGES_IDENTITY;
+            else if (strcmp(optarg, "random") == 0)
+                pages = PAGES_RANDOM;
+            else if (strcmp(optarg, "color") == 0)
+                pages = PAGES_COLOR;
+            else if (strcmp(optarg, "huge") == 0)
+                pages = PAGES_HUGE;
+            else {
+                printf("Error: unknown page allocator %s\n", optarg);
+                printUsage(argv[0]);
+                exit(-1);
+            }
+
+            break;
+        case OPT_PAGE_SEED:
+            pageSeed = getCountArg("page-seed", argv[0]);
+            break;
+        case OPT_PAGE_TRIALS:
+            pageTrials = getCountArg("page-trials", argv[0]);
+            break;
+        case OPT_TIMING:
+            timing = true;
+            break;
+        case OPT_HIT_LATENCY:
+            hitLatency = getArg("hit-latency", argv[0]);
+            break;
+        case OPT_VICTIM_LATENCY:
+            victimLatency = getArg("victim-latency", argv[0]);
+            break;
+        case OPT_MEMORY_LATENCY:
+            memoryLatency = getArg("memory-latency", argv[0]);
+            break;
+        case OPT_MSHRS:
+            mshrCount = getArg("mshrs", argv[0]);
+            break;
+        case OPT_BANDWIDTH:
+            bandwidth = getArg("bandwidth", argv[0]);
+            break;
+        case OPT_PROFILE:
+#ifdef CSIM_PROFILE
+            profile = true;
+            break;
+#else
+            printf("Error: csim was built without CSIM_PROFILE\n");
+            exit(-1);
+#endif
+        case OPT_INTERVAL_FILE:
+            if ((intervalfile = fopen(optarg, "w")) == NULL) {
+                printf("Error: failed to open file %s\n", optarg);
+                exit(-1);
+            }
+
             break;
         default:
             printf("Error: unknown option\n");
-            printf(usage, argv[0]);
+            printUsage(argv[0]);
             exit(-1);
         }
     }
-}
 
-/* Parses a command-line integer argument and exit if the argument is
- * ill-formed. `arg` is the name of the command-line argument, and `prog` is the
- * program name. The command-line argument must be a positive integer. Returns
- * the parsed integer if it was successful, exits the program with exit status
- * -1 otherwise. */
-static int getArg(char arg[], char prog[]) {
-    int retval = (int) strtol(optarg, (char **) NULL, 10);
+    /* The jobs of a batch parse their own options. */
+    if (batchPath != NULL) {
+        if (optind == argc) {
+            printf("Error: missing required argument\n");
+            printUsage(argv[0]);
+            exit(-1);
+        }
 
-    if (errno != 0 || retval < 0) {
-        printf("Error: invalid format of argument %s\n", arg);
-        printf(usage, prog);
+        return;
+    }
+
+    /* Snapshots don't hold the breakdowns, whose totals would then disagree
+     * with the statistics restored from the snapshot. */
+    if (loadPath != NULL && statsPath != NULL) {
+        printf("Error: --stats excludes --load-state\n");
         exit(-1);
     }
 
-    return retval;
-}
+    /* The warm-up of a loaded simulation is the rest of the saved one. */
+    if (loadPath != NULL && warmup > 0) {
+        printf("Error: --warmup excludes --load-state, which resumes the "
+               "saved warm-up\n");
+        exit(-1);
+    }
 
-/* Parse each access (one line) contained in the trace file. `line` is the
- * input string corresponds to a memory access. `type`, `addr` `size` is the
- * destination pointer for each memory access properties. Returns 0 if parsing
- * was successful, -1 otherwise. All output parameters must not be NULL. */
-static int parseAccess(char line[], access_t *dst) {
-    if (sscanf(line, " %c %" PRIx64 ",%zu\n", &dst->type, &dst->addr,
-               &dst->size) < 3)
-        return -1;
+    /* The geometry of the cache comes from the snapshot if one is loaded, so
+     * -s, -E and -b are only required for a fresh simulation. */
+    if ((trace == NULL && tenantCount == 0) ||
+        (loadPath == NULL && (!geometry || assoc == 0))) {
+        printf("Error: missing required argument\n");
+        printUsage(argv[0]);
+        exit(-1);
+    }
 
-    if (dst->type != 'M' && dst->type != 'L' && dst->type != 'S')
-        return -1;
+    /* The tenants replace the single trace, and their positions cannot be
+     * told by one number, so they start afresh and can't be resumed. */
+    if (tenantCount > 0 && (trace != NULL || loadPath != NULL ||
+                            savePath != NULL || offset != -1)) {
+        printf("Error: --tenant excludes -t, -o, --save-state and "
+               "--load-state\n");
+        exit(-1);
+    }
 
-    return 0;
-};
+    /* The page mapping depends on the order the pages are first touched in, so
+     * it can't be resumed, and the tenants would share frames. */
+    if (pages != PAGES_IDENTITY &&
+        (loadPath != NULL || savePath != NULL || tenantCount > 0)) {
+        printf("Error: --pages excludes --tenant, --save-state and "
+               "--load-state\n");
+        exit(-1);
+    }
 
-/* Run the simulation with respect to the simulation arguments. */
-static void runSimulation() {
-    char input[64];
+    if (pageTrials > 0 && (pages == PAGES_IDENTITY || trace == NULL)) {
+        printf("Error: --page-trials requires --pages and -t\n");
+        exit(-1);
+    }
 
-    access_t access;
-    cache_t *cache = makeCache();
+    /* A binary trace is seeked by record, so every record has to be an
+     * access; the victim records are only written to a text stream, where
+     * the readers skip them like the other lines that are not accesses. */
+    if (streamVictims && streamBinary) {
+        printf("Error: --miss-stream-victims requires the text stream "
+               "format\n");
+        exit(-1);
+    }
 
-    while (fgets(input, 64, tracefile) != NULL) {
-        if (input[0] != ' ')
+    if (quantum == 0) {
+        printf("Error: --quantum must be positive\n");
+        exit(-1);
+    }
+
+    for (size_t i = 0; i < tenantCount; i++) {
+        uint64_t ways = assoc >= 64 ? UINT64_MAX : ((uint64_t) 1 << assoc) - 1;
+
+        if (tenants[i].mask == UINT64_MAX)
             continue;
 
-        if (parseAccess(input, &access) == -1) {
-            printf("Error: parsing failed\n");
+        if (tenants[i].mask == 0 || (tenants[i].mask & ~ways) != 0) {
+            printf("Error: way mask of %s is empty or exceeds E\n",
+                   tenants[i].path);
             exit(-1);
         }
-
-        processAccess(cache, &access);
     }
 
-    destroyCache(cache);
-};
-
-/* Initialize a fresh simulation cache using the configuration `indexBits` and
- * `offsetBits`, and return the initialize cache object. */
-static cache_t *makeCache() {
-    cache_t *cache = (cache_t *) malloc(sizeof(cache_t));
+    /* Only modulo indexing can have a number of sets other than 2^s. */
+    if (sets != 0 && indexing != INDEX_PRIME) {
+        printf("Error: --sets requires --index prime\n");
+        exit(-1);
+    }
 
-    if (cache == NULL) {
-        printf("Error: allocation failed\n");
+    /* The set index and block bits of an address must fit in it. */
+    if (indexBits >= 64 || offsetBits >= 64 || indexBits + offsetBits > 64) {
+        printf("Error: -s and -b must add up to at most 64\n");
         exit(-1);
     }
 
-    int size = (1 << indexBits) * assoc;
+    if (sets == 0 && assoc != 0)
+        sets = indexing == INDEX_PRIME ? findPrime((size_t) 1 << indexBits)
+                                       : (size_t) 1 << indexBits;
 
-    cache->size = size;
-    cache->valid = (bool *) calloc(size, sizeof(bool));
-    cache->ranks = (uint64_t *) calloc(size, sizeof(uint64_t));
-    cache->tags = (uint64_t *) calloc(size, sizeof(uint64_t));
+    /* A sector is a power-of-two fraction of a block, and the sector bits of a
+     * line have to fit in a word. */
+    if (sectors != 0 && ((sectors & (sectors - 1)) != 0 || sectors > 64 ||
+                         sectors > ((size_t) 1 << offsetBits))) {
+        printf("Error: --sectors must be a power of two of at most 64 and the "
+               "block size\n");
+        exit(-1);
+    }
 
-    if (cache->valid == NULL || cache->ranks == NULL || cache->tags == NULL) {
-        printf("Error: allocation failed\n");
+    if (timing && mshrCount == 0) {
+        printf("Error: --mshrs must be positive\n");
         exit(-1);
     }
 
-    /* The ranks in the set are initialized to 0, 1, 2, ... , assoc - 1. In
-     * other words, former lines in a set are considered as more recently
-     * updated. */
-    for (int i = 0; i < size; i++)
-        cache->ranks[i] = i % assoc;
+    /* The windows stay off stdout, so that the summary can be piped alone. */
+    if (interval > 0 && intervalfile == NULL)
+        intervalfile = stderr;
 
-    return cache;
+    if (statsFormat != NULL)
+        statsCSV = strcmp(statsFormat, "csv") == 0;
+    else if (statsPath != NULL && strlen(statsPath) >= 4)
+        statsCSV = strcmp(statsPath + strlen(statsPath) - 4, ".csv") == 0;
 }
 
-/* Free the resources allocated for `cache`, including the cache object itself.
+/* Print the usage info of the program `prog` after an error in the options.
+ * A job of a batch only reports the error itself in a line, so that a bad
+ * configuration doesn't bury the results table under a usage info per trace.
  */
-static void destroyCache(cache_t *cache) {
-    assert(cache != NULL && cache->valid != NULL && cache->ranks != NULL &&
-           cache->tags != NULL);
-
-    free(cache->valid);
-    free(cache->ranks);
-    free(cache->tags);
-    free(cache);
+static void printUsage(char prog[]) {
+    if (batchConfigs == NULL)
+        printf(usage, prog, prog, prog);
 }
 
-/* Process one memory access, `access`, and updates the states of `cache`. */
-static void processAccess(cache_t *cache, access_t *access) {
-    assert(cache != NULL && access != NULL);
+/* Parses a command-line integer argument and exit if the argument is
+ * ill-formed. `arg` is the name of the command-line argument, and `prog` is the
+ * program name. The command-line argument must be a positive integer that fits
+ * an int, with nothing after it. Returns the parsed integer if it was
+ * successful, exits the program with exit status -1 otherwise. */
+static int getArg(char arg[], char prog[]) {
+    char *end;
 
-    int hit = 0;
-    bool miss = false, evict = false;
-    uint64_t index = getIndex(access->addr) * assoc;
+    errno = 0;
+    long retval = strtol(optarg, &end, 10);
 
-    /* Check if there's any hit line. */
-    for (size_t line = index; line < index + assoc; line++) {
-        if (cache->valid[line] && cache->tags[line] == getTag(access->addr)) {
-            hit++;
-            updateRank(cache, index, line);
-            break;
-        }
+    if (errno != 0 || retval < 0 || retval > INT_MAX || end == optarg ||
+        *end != '\0') {
+        printf("Error: invalid format of argument %s\n", arg);
+        printUsage(prog);
+        exit(-1);
     }
 
-    /* If not hit, find the LRU line and update its validity and tag, and
-     * updates the ranks. */
-    if (!hit) {
-        uint64_t lru = findLRULine(cache, index);
-        miss = true;
-        evict = cache->valid[lru];
-
-        cache->valid[lru] = true;
-        cache->tags[lru] = getTag(access->addr);
+    return (int) retval;
+}
 
-        updateRank(cache, index, lru);
-    }
+/* Return `count` as an int, clamped to INT_MAX, for the interfaces that hold
+ * the statistics in ints. */
+static int clampCount(uint64_t count) {
+    return count > INT_MAX ? INT_MAX : (int) count;
+}
 
-    /* Also, if the access type is modification, add one more hit count since
-     * subsequent store access will be always hit. */
-    if (access->type == 'M')
-        hit++;
+/* Parses a command-line count argument, such as a number of trace accesses,
+ * in the same manner as `getArg`, but allows values beyond the range of `int`.
+ */
+static int64_t getCountArg(char arg[], char prog[]) {
+    char *end;
 
-    updateStat(hit, miss, evict, access);
+    errno = 0;
+    long long retval = strtoll(optarg, &end, 10);
 
-    if (diagnostics)
-        printAccess(hit, miss, evict, access);
+    if (errno != 0 || retval < 0 || end == optarg || *end != '\0') {
+        printf("Error: invalid format of argument %s\n", arg);
+        printUsage(prog);
+        exit(-1);
+    }
 
-    if (state)
-        printCache(cache);
+    return retval;
 }
 
-/* Return the set index of the given address `addr`. */
-static inline uint64_t getIndex(uint64_t addr) {
-    return (addr >> offsetBits) & ((1 << indexBits) - 1);
-}
+/* Parses the argument of --warmup, which is a count of accesses, or a count of
+ * bytes if it ends with 'B'. Exits the program if the argument is ill-formed.
+ */
+static void getWarmupArg(char prog[]) {
+    char *end;
 
-/* Return the block offset of the given address `addr`. */
-static inline uint64_t getOffset(uint64_t addr) {
-    return addr & ((1 << offsetBits) - 1);
-};
+    errno = 0;
+    long long retval = strtoll(optarg, &end, 10);
+    warmupBytes = *end == 'B';
 
-/* Return the tag of the given address `addr`. */
-static inline uint64_t getTag(uint64_t addr) {
-    return addr >> (offsetBits + indexBits);
-};
+    if (errno != 0 || retval < 0 || end == optarg ||
+        *(end + warmupBytes) != '\0') {
+        printf("Error: invalid format of argument warmup\n");
+        printUsage(prog);
+        exit(-1);
+    }
 
-/* Update statistics according to given hit, miss, evict conditions. Note that
- * it accepts the number of hits, instead of whether an access was hit, due to
- * an modification access can hit twice. */
-static void updateStat(int hit, bool miss, bool evict, access_t *access) {
-    assert(access != NULL);
-    assert(0 <= hit && hit <= 2);
+    warmup = retval;
+}
 
-    if (verbose) {
-        printf("%c %" PRIx64 ",%zu ", access->type, access->addr, access->size);
+/* Parses the hexadecimal address at the start of `text`, which is (a part of)
+ * the argument `arg`. If `end` is NULL, the address must be all of `text`;
+ * otherwise `end` is set to the character after the address. Exits the program
+ * if the address is ill-formed. */
+static uint64_t getAddressArg(char arg[], char text[], char **end) {
+    char *rest;
 
-        if (miss)
-            printf("miss ");
-        if (evict)
-            printf("eviction ");
-        for (int i = 0; i < hit; i++)
-            printf("hit ");
-        printf("\n");
+    errno = 0;
+    uint64_t retval = strtoull(text, &rest, 16);
+
+    if (errno != 0 || rest == text || (end == NULL && *rest != '\0')) {
+        printf("Error: invalid format of argument %s\n", arg);
+        exit(-1);
     }
 
-    if (miss)
-        misses++;
-    if (evict)
-        evictions++;
-    hits += hit;
+    if (end != NULL)
+        *end = rest;
+
+    return retval;
 }
 
-/* Updates LRU ranks of `cache` for cache access for `line` and set index
- * `index`. It expects the ranks in `cache` are in valid state. i.e. the ranks
- * are valid permutation of 0, 1, 2, ..., assoc - 1. */
-static void updateRank(cache_t *cache, uint64_t index, uint64_t line) {
-    assert(cache != NULL && index < cache->size && line < cache->size);
+/* Parses the range `arg` of the form <low>-<high> and appends it to the
+ * `count` ranges of `ranges`. Exits the program if the range is ill-formed. */
+static void addRange(range_t **ranges, size_t *count, char arg[]) {
+    range_t range;
+    char *end;
 
-    /* Since `line` is already the least recently used line, there's no need
-     * to update ranks. */
-    if (cache->ranks[line] == 0)
-        return;
+    range.low = getAddressArg("range", arg, &end);
 
-    /* Increase ranks by one. */
-    for (size_t i = index; i < index + assoc; i++) {
-        if (cache->ranks[i] < cache->ranks[line])
-            cache->ranks[i]++;
+    if (*end != '-') {
+        printf("Error: invalid format of argument range\n");
+        exit(-1);
     }
 
-    /* Finally, update the accessed line's rank to zero (most recently used). */
-    cache->ranks[line] = 0;
-}
-
-/* Find the least recently used line within the set index `index` and returns
- * the line number of the line. */
-static uint64_t findLRULine(cache_t *cache, uint64_t index) {
-    assert(cache != NULL && index < cache->size);
+    range.high = getAddressArg("range", end + 1, NULL);
+    *ranges = (range_t *) realloc(*ranges, (*count + 1) * sizeof(range_t));
 
-    /* The line with rank of `assoc` - 1 is the least recently used; find it and
-     * return it. */
-    for (size_t line = index; line < index + assoc; line++) {
-        if (cache->ranks[line] == assoc - 1)
-            return line;
+    if (*ranges == NULL) {
+        printf("Error: allocation failed\n");
+        exit(-1);
     }
 
-    /* This should not happen in principle, so install an assertion for
-     * debugging. */
-    assert(false);
+    (*ranges)[(*count)++] = range;
 }
 
-/* Clean up the used resources. */
-static void finalizeTrace() {
-    assert(tracefile != NULL);
+/* Parses the argument of --types, which is a non-empty string of the access
+ * types L, S and M. Exits the program if the argument is ill-formed. */
+static void getTypesArg(char prog[]) {
+    typeKept[0] = typeKept[1] = typeKept[2] = false;
 
-    if (fclose(tracefile) == EOF) {
+    for (char *type = optarg; *type != '\0'; type++) {
+        if (*type != 'L' && *type != 'S' && *type != 'M') {
+            printf("Error: invalid format of argument types\n");
+            printUsage(prog);
+            exit(-1);
+        }
+
+        typeKept[getTypeIndex(*type)] = true;
+    }
+
+    if (*optarg == '\0') {
+        printf("Error: invalid format of argument types\n");
+        printUsage(prog);
+        exit(-1);
+    }
+}
+
+/* Open the trace file `path` into `reader` and find out whether it is a
+ * binary trace, in which case the magic is consumed. Exits the program if
+ * opening fails. */
+static void openTrace(reader_t *reader, char path[]) {
+    char magic[TRACE_MAGIC_SIZE];
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        printf("Error: failed to open file %s\n", path);
+        exit(-1);
+    }
+
+    bool read = fread(magic, 1, TRACE_MAGIC_SIZE, fp) == TRACE_MAGIC_SIZE;
+
+    reader->file = fp;
+    reader->data = NULL;
+    reader->binary = read && memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0;
+    reader->runs = read && memcmp(magic, RUN_MAGIC, TRACE_MAGIC_SIZE) == 0;
+    reader->group[0].count = 0;
+    reader->lane = 0;
+    reader->count = reader->next = 0;
+    reader->open = reader->ended = false;
+
+    if (!reader->binary && !reader->runs)
+        rewind(fp);
+}
+
+/* Map the trace file `path` into memory for `reader`, read-only, so that any
+ * number of simulations, including those of forked processes, share a single
+ * copy of it. Exits the program if mapping fails. */
+static void mapTrace(reader_t *reader, char path[]) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        printf("Error: failed to open file %s\n", path);
+        exit(-1);
+    }
+
+    const char *data =
+        st.st_size == 0
+            ? ""
+            : mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        printf("Error: failed to map file %s\n", path);
+        exit(-1);
+    }
+
+    attachTrace(reader, data, st.st_size);
+}
+
+/* Set up `reader` to read the trace of `length` bytes at `data`, in whichever
+ * format its magic tells. */
+static void attachTrace(reader_t *reader, const char *data, size_t length) {
+    bool magic = length >= TRACE_MAGIC_SIZE;
+
+    memset(reader, 0, sizeof(reader_t));
+    reader->data = data;
+    reader->length = length;
+    reader->binary = magic && memcmp(data, TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0;
+    reader->runs = magic && memcmp(data, RUN_MAGIC, TRACE_MAGIC_SIZE) == 0;
+    reader->at = reader->binary || reader->runs ? TRACE_MAGIC_SIZE : 0;
+}
+
+/* Read a line of the text trace into `buf` as `fgets` does, from memory if
+ * the trace is mapped. Returns `buf`, or NULL at the end of the trace. */
+static char *readLine(char buf[], int size) {
+    if (trace->data == NULL)
+        return fgets(buf, size, trace->file);
+
+    if (trace->at == trace->length)
+        return NULL;
+
+    int length = 0;
+
+    while (length < size - 1 && trace->at < trace->length) {
+        char ch = trace->data[trace->at++];
+        buf[length++] = ch;
+
+        if (ch == '\n')
+            break;
+    }
+
+    buf[length] = '\0';
+    return buf;
+}
+
+/* Parse the argument of --tenant, which is a trace optionally followed by a
+ * colon and a hexadecimal way mask, and add the tenant. A suffix that is not a
+ * number is taken as a part of the file name. */
+static void addTenant(char arg[]) {
+    char *colon = strrchr(arg, ':'), *end;
+    uint64_t mask = UINT64_MAX;
+
+    if (colon != NULL && colon[1] != '\0') {
+        errno = 0;
+        mask = strtoull(colon + 1, &end, 16);
+
+        if (errno != 0 || *end != '\0')
+            mask = UINT64_MAX;
+        else
+            *colon = '\0';
+    }
+
+    if (tenantCount == (size_t) 1 << (64 - tenantShift)) {
+        printf("Error: too many tenants\n");
+        exit(-1);
+    }
+
+    tenants =
+        (tenant_t *) realloc(tenants, (tenantCount + 1) * sizeof(tenant_t));
+
+    if (tenants == NULL) {
+        printf("Error: allocation failed\n");
+        exit(-1);
+    }
+
+    tenant_t *added = &tenants[tenantCount++];
+    memset(added, 0, sizeof(tenant_t));
+    added->path = arg;
+    added->mask = mask;
+    openTrace(&added->reader, arg);
+}
+
+/* Parse each access (one line) contained in the trace file. `line` is the
+ * input string corresponds to a memory access. `type`, `addr` `size` is the
+ * destination pointer for each memory access properties. Returns 0 if parsing
+ * was successful, -1 otherwise. All output parameters must not be NULL. */
+static int parseAccess(char line[], access_t *dst) {
+    if (sscanf(line, " %c %" PRIx64 ",%zu\n", &dst->type, &dst->addr,
+               &dst->size) < 3)
+        return -1;
+
+    if (dst->type != 'M' && dst->type != 'L' && dst->type != 'S')
+        return -1;
+
+    return 0;
+};
+
+/* Read the next access of the trace into `dst`, skipping the lines of a
+ * valgrind trace that are not data accesses. Returns true if an access was
+ * read, false at the end of the trace. Exits the program if the trace is
+ * ill-formed. */
+static bool readAccess(access_t *dst) {
+    char input[64];
+
+    /* An access of a run-length trace is the next one of the current run of
+     * the group, and the runs take turns. */
+    if (trace->runs) {
+        if (trace->group[trace->lane].count == 0 && !nextRun())
+            return false;
+
+        run_record_t *run = &trace->group[trace->lane];
+
+        dst->type = run->type;
+        dst->addr = run->base;
+        dst->size = run->size;
+        run->base += run->stride;
+        run->count--;
+        trace->lane = (trace->lane + 1) % trace->lanes;
+        PROFILE_MARK(PHASE_READ);
+
+        if (dst->type != 'M' && dst->type != 'L' && dst->type != 'S') {
+            printf("Error: parsing failed\n");
+            exit(-1);
+        }
+
+        return true;
+    }
+
+    if (trace->binary) {
+        trace_record_t *record;
+
+        /* The records of a mapped trace are read in place. */
+        if (trace->data != NULL) {
+            if (trace->length - trace->at < sizeof(trace_record_t))
+                return false;
+
+            record = (trace_record_t *) (trace->data + trace->at);
+            trace->at += sizeof(trace_record_t);
+        } else {
+            if (trace->next == trace->count) {
+                trace->count = fread(trace->records, sizeof(trace_record_t),
+                                     sizeof(trace->records) /
+                                         sizeof(trace_record_t),
+                                     trace->file);
+                trace->next = 0;
+
+                if (trace->count == 0)
+                    return false;
+            }
+
+            record = &trace->records[trace->next++];
+        }
+
+        dst->type = record->type;
+        dst->addr = record->addr;
+        dst->size = record->size;
+        PROFILE_MARK(PHASE_READ);
+
+        if (dst->type != 'M' && dst->type != 'L' && dst->type != 'S') {
+            printf("Error: parsing failed\n");
+            exit(-1);
+        }
+
+        return true;
+    }
+
+    while (readLine(input, 64) != NULL) {
+        PROFILE_MARK(PHASE_READ);
+
+        if (input[0] != ' ')
+            continue;
+
+        if (parseAccess(input, dst) == -1) {
+            printf("Error: parsing failed\n");
+            exit(-1);
+        }
+
+        PROFILE_MARK(PHASE_PARSE);
+        return true;
+    }
+
+    return false;
+}
+
+/* Read the next run record of a run-length trace into `dst`. Returns false at
+ * the end of the trace. */
+static bool readRun(run_record_t *dst) {
+    if (trace->data == NULL)
+        return fread(dst, sizeof(run_record_t), 1, trace->file) == 1;
+
+    if (trace->length - trace->at < sizeof(run_record_t))
+        return false;
+
+    memcpy(dst, trace->data + trace->at, sizeof(run_record_t));
+    trace->at += sizeof(run_record_t);
+    return true;
+}
+
+/* Read the next non-empty group of runs, or run, of a run-length trace into
+ * `group` of the trace. Returns false at the end of the trace. Exits the
+ * program if the group is ill-formed. */
+static bool nextRun() {
+    run_record_t *group = trace->group;
+
+    do {
+        if (!readRun(&group[0]))
+            return false;
+
+        trace->lanes = group[0].lanes > 1 ? group[0].lanes : 1;
+
+        if (trace->lanes > RUN_MAX_LANES) {
+            printf("Error: parsing failed\n");
+            exit(-1);
+        }
+
+        for (size_t i = 1; i < trace->lanes; i++) {
+            if (!readRun(&group[i]) || group[i].count != group[0].count) {
+                printf("Error: parsing failed\n");
+                exit(-1);
+            }
+        }
+    } while (group[0].count == 0);
+
+    trace->lane = 0;
+    return true;
+}
+
+/* Read the next access of the trace that passes the filters into `dst`,
+ * advancing the trace position past the accesses filtered out as well. Returns
+ * false at the end of the trace or of the region of interest. */
+static bool nextAccess(access_t *dst) {
+    while (!trace->ended && readAccess(dst)) {
+        position++;
+
+        if (keepAccess(dst)) {
+            if (pages != PAGES_IDENTITY)
+                dst->addr = translate(dst->addr);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Return true if `access` passes the filters: it is within the region of
+ * interest between the markers, which includes the markers themselves, of one
+ * of the types to simulate, and within the included but not the excluded
+ * ranges. */
+static bool keepAccess(access_t *access) {
+    if (startMarked && !trace->open) {
+        if (access->addr != startMarker)
+            return false;
+
+        trace->open = true;
+    }
+
+    if (endMarked && access->addr == endMarker)
+        trace->ended = true;
+
+    return typeKept[getTypeIndex(access->type)] &&
+           (includeCount == 0 ||
+            inRanges(includes, includeCount, access->addr)) &&
+           !inRanges(excludes, excludeCount, access->addr);
+}
+
+/* Return true if `addr` is within any of the `count` ranges of `ranges`. */
+static bool inRanges(range_t ranges[], size_t count, uint64_t addr) {
+    for (size_t i = 0; i < count; i++) {
+        if (ranges[i].low <= addr && addr < ranges[i].high)
+            return true;
+    }
+
+    return false;
+}
+
+/* Return the physical address of the virtual address `addr`. A page is
+ * allocated a frame when it is first touched. The n-th page touched gets the
+ * n-th frame of a permutation of the frames, so that no two pages share a
+ * frame. A colored frame keeps the bits of the page that take part in the set
+ * index of the cache, and permutes the rest. */
+static uint64_t translate(uint64_t addr) {
+    int bits = pages == PAGES_HUGE ? hugePageBits : pageBits;
+    page_t *entry = findPage(addr >> bits);
+
+    if (entry->frame == UINT64_MAX) {
+        int frameBits = physicalBits - bits, colorBits = 0;
+
+        if (pages == PAGES_COLOR && (int) (indexBits + offsetBits) > bits)
+            colorBits = indexBits + offsetBits - bits;
+        if (colorBits > frameBits)
+            colorBits = frameBits;
+
+        if (pageCount > ((uint64_t) 1 << (frameBits - colorBits))) {
+            printf("Error: the trace touches more pages than physical "
+                   "memory\n");
+            exit(-1);
+        }
+
+        uint64_t color = entry->page & (((uint64_t) 1 << colorBits) - 1);
+        entry->frame =
+            permute(pageCount - 1, frameBits - colorBits) << colorBits | color;
+    }
+
+    return entry->frame << bits | (addr & (((uint64_t) 1 << bits) - 1));
+}
+
+/* Return the entry of the page mapping of the virtual page `page`, adding an
+ * entry without a frame (UINT64_MAX) if there is none. The table is organized
+ * as `findRegion` does. */
+static page_t *findPage(uint64_t page) {
+    if (2 * (pageCount + 1) > pageCapacity) {
+        page_t *old = pageTable;
+        size_t oldCapacity = pageCapacity;
+
+        pageCapacity = oldCapacity == 0 ? 1024 : 2 * oldCapacity;
+        pageTable = (page_t *) calloc(pageCapacity, sizeof(page_t));
+
+        if (pageTable == NULL) {
+            printf("Error: allocation failed\n");
+            exit(-1);
+        }
+
+        pageCount = 0;
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (old[i].used)
+                findPage(old[i].page)->frame = old[i].frame;
+        }
+
+        free(old);
+    }
+
+    size_t mask = pageCapacity - 1;
+    size_t i = (page * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+
+    while (pageTable[i].used && pageTable[i].page != page)
+        i = (i + 1) & mask;
+
+    if (!pageTable[i].used) {
+        pageTable[i].used = true;
+        pageTable[i].page = page;
+        pageTable[i].frame = UINT64_MAX;
+        pageCount++;
+    }
+
+    return &pageTable[i];
+}
+
+/* Return the image of `n` under a permutation of the numbers of `bits` bits
+ * chosen by `pageSeed`. Each step, adding a constant, multiplying by an odd
+ * number and XORing with a right shift, is invertible modulo 2^bits. */
+static uint64_t permute(uint64_t n, int bits) {
+    if (bits == 0)
+        return 0;
+
+    uint64_t mask = bits == 64 ? UINT64_MAX : ((uint64_t) 1 << bits) - 1;
+    uint64_t key = pageSeed * 0x9e3779b97f4a7c15ULL;
+    int shift = bits / 2 + 1;
+
+    for (int round = 0; round < 3; round++) {
+        n = (n + key) & mask;
+        n = (n * 0xbf58476d1ce4e5b9ULL) & mask;
+        n ^= n >> shift;
+        key = key * 0x2545f4914f6cdd1dULL + 1;
+    }
+
+    return n;
+}
+
+/* Skip the next `count` accesses of the trace, advancing the trace position.
+ * Skipped accesses don't even need to be parsed, and a binary trace is simply
+ * seeked past them. */
+static void skipAccesses(uint64_t count) {
+    char input[64];
+
+    /* The whole rounds of a group are skipped at once, and the accesses of a
+     * partial round one at a time. */
+    while (trace->runs && position < count &&
+           (trace->group[trace->lane].count > 0 || nextRun())) {
+        run_record_t *group = trace->group;
+        uint64_t rounds = (count - position) / trace->lanes;
+
+        if (trace->lane == 0 && rounds > 0) {
+            rounds = rounds < group[0].count ? rounds : group[0].count;
+
+            for (size_t i = 0; i < trace->lanes; i++) {
+                group[i].base += rounds * group[i].stride;
+                group[i].count -= rounds;
+            }
+
+            position += rounds * trace->lanes;
+        } else {
+            group[trace->lane].base += group[trace->lane].stride;
+            group[trace->lane].count--;
+            trace->lane = (trace->lane + 1) % trace->lanes;
+            position++;
+        }
+    }
+
+    if (trace->runs)
+        return;
+
+    if (trace->binary && trace->data != NULL) {
+        size_t left = (trace->length - trace->at) / sizeof(trace_record_t);
+
+        count = count < left ? count : left;
+        trace->at += count * sizeof(trace_record_t);
+        position += count;
+        return;
+    }
+
+    if (trace->binary) {
+        if (fseeko(trace->file, (off_t) (count * sizeof(trace_record_t)),
+                   SEEK_CUR) == -1) {
+            printf("Error: failed to seek the trace\n");
+            exit(-1);
+        }
+
+        position += count;
+        return;
+    }
+
+    while (position < count && readLine(input, 64) != NULL) {
+        if (input[0] == ' ')
+            position++;
+    }
+}
+
+/* Run the simulation with respect to the simulation arguments. */
+static void runSimulation() {
+    access_t access;
+    cache_t *cache = loadPath != NULL ? loadState(loadPath) : makeCache();
+    uint64_t skip = offset != -1 ? (uint64_t) offset : position;
+
+    /* The region of interest of a snapshot only holds where it stopped. */
+    if (offset != -1 && trace != NULL)
+        trace->open = trace->ended = false;
+
+    position = 0;
+
+    if (statsPath != NULL) {
+        setStats = (counter_t *) calloc(sets, sizeof(counter_t));
+
+        if (setStats == NULL) {
+            printf("Error: allocation failed\n");
+            exit(-1);
+        }
+    }
+
+    if (tenantCount == 0)
+        skipAccesses(skip);
+
+    if (streamPath != NULL)
+        openStream();
+
+    if (timing)
+        makeTiming();
+
+#ifdef CSIM_PROFILE
+    clock_gettime(CLOCK_MONOTONIC, &profileStart);
+    profileStamp = readTicks();
+    profileFirst = position;
+#endif
+
+    if (tenantCount > 0) {
+        runTenants(cache);
+    } else {
+        bool bulk = canFastForward();
+
+        while (nextAccess(&access)) {
+            processAccess(cache, &access);
+
+            if (bulk)
+                fastForward(cache, &access);
+        }
+    }
+
+    /* A window left open is saved to be continued instead. */
+    if (windowAccesses > 0 && savePath == NULL)
+        flushWindow();
+
+    if (streamfile != NULL)
+        closeStream();
+
+    if (savePath != NULL)
+        saveState(cache, savePath);
+
+    if (statsPath != NULL)
+        writeStats();
+
+    destroyCache(cache);
+};
+
+/* Return true if the accesses of runs may be simulated in bulk, which takes a
+ * run-length trace and nothing that needs to see every access. */
+static bool canFastForward() {
+    return trace->runs && pages == PAGES_IDENTITY && !verbose &&
+           !diagnostics && !state && !timing && statsPath == NULL &&
+           interval == 0 && sectors == 0 && !startMarked && !endMarked &&
+           includeCount == 0 && excludeCount == 0 && typeKept[0] &&
+           typeKept[1] && typeKept[2];
+}
+
+/* Simulate the accesses of the current run that fall into the same block as
+ * `last`, the access just simulated, all at once. The block has just been
+ * accessed, so each of them hits and leaves the replacement state as it is,
+ * except for the use clock of a skewed cache. */
+static void fastForward(cache_t *cache, access_t *last) {
+    run_record_t *run = &trace->group[0];
+    uint64_t block = last->addr >> offsetBits, count;
+
+    /* Only a run of its own is fast-forwarded; the runs of a group interleave
+     * with each other. */
+    if (warmup > 0 || trace->lanes != 1 || run->count == 0 ||
+        run->base >> offsetBits != block)
+        return;
+
+    if (run->stride == 0)
+        count = run->count;
+    else if (run->stride > 0)
+        count = (((block + 1) << offsetBits) - run->base - 1) / run->stride + 1;
+    else
+        count = (run->base - (block << offsetBits)) / -run->stride + 1;
+
+    /* A run holds up to 2^32 - 1 accesses, so a modify run alone can add
+     * more hits than an int holds. The count and the hits are 64-bit. */
+    count = count < run->count ? count : run->count;
+    hits += count * (uint64_t) (run->type == 'M' ? 2 : 1);
+    position += count;
+    run->base += count * run->stride;
+    run->count -= count;
+
+    if (indexing == INDEX_SKEW) {
+        useClock += count;
+        cache->ranks[recentLine] = useClock;
+    }
+}
+
+/* Run every configuration of `batchPath` on each of the `traceCount` traces
+ * `paths`, and print the results as a CSV table. The traces are mapped once
+ * and shared by all the jobs. The results are printed in the order of the
+ * jobs, so the table does not depend on the number of workers. */
+static void runBatch(char *paths[], size_t traceCount) {
+    batchConfigs = readConfigs(&batchConfigCount);
+    batchReaders = (reader_t *) malloc(traceCount * sizeof(reader_t));
+
+    if (batchReaders == NULL) {
+        printf("Error: allocation failed\n");
+        exit(-1);
+    }
+
+    for (size_t i = 0; i < traceCount; i++)
+        mapTrace(&batchReaders[i], paths[i]);
+
+    size_t jobCount = traceCount * batchConfigCount;
+    job_t *jobs = runJobs(jobCount, runBatchJob);
+
+    printf("trace,config,hits,misses,evictions,victim_hits\n");
+
+    for (size_t i = 0; i < jobCount; i++) {
+        printf("%s,\"%s\",", paths[i / batchConfigCount],
+               batchConfigs[i % batchConfigCount]);
+
+        if (jobs[i].done)
+            printf("%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                   jobs[i].stats.hits, jobs[i].stats.misses,
+                   jobs[i].stats.evictions, jobs[i].stats.victimHits);
+        else
+            printf("error,,,\n");
+    }
+}
+
+/* Run the `jobCount` jobs numbered from 0 with `run`, and return their results
+ * in memory shared with the workers. Each job runs in a forked process, since
+ * the simulator keeps its state in globals, and up to `workers` of them run at
+ * once, the next job starting as soon as any finishes. A job that fails exits
+ * without marking its result as done. */
+static job_t *runJobs(size_t jobCount, void (*run)(size_t job)) {
+    size_t next = 0, running = 0;
+    job_t *jobs = jobCount == 0 ? NULL
+                                : mmap(NULL, jobCount * sizeof(job_t),
+                                       PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (jobs == MAP_FAILED) {
+        printf("Error: allocation failed\n");
+        exit(-1);
+    }
+
+    if (workers == 0)
+        workers = sysconf(_SC_NPROCESSORS_ONLN) > 0
+                      ? sysconf(_SC_NPROCESSORS_ONLN)
+                      : 1;
+
+    /* The children inherit the buffer of stdout, which must not be printed
+     * twice. */
+    fflush(stdout);
+
+    while (next < jobCount || running > 0) {
+        if (next < jobCount && running < (size_t) workers) {
+            pid_t pid = fork();
+
+            if (pid == -1) {
+                printf("Error: failed to fork a worker\n");
+                exit(-1);
+            }
+
+            /* The diagnostics of a job go to stderr, leaving stdout to the
+             * results of the parent. */
+            if (pid == 0) {
+                dup2(STDERR_FILENO, STDOUT_FILENO);
+                run(next);
+
+                jobs[next].stats.hits = hits;
+                jobs[next].stats.misses = misses;
+                jobs[next].stats.evictions = evictions;
+                jobs[next].stats.victimHits = victimHits;
+                jobs[next].done = true;
+                finalizeTrace();
+                exit(0);
+            }
+
+            next++;
+            running++;
+        } else if (wait(NULL) != -1) {
+            running--;
+        }
+    }
+
+    return jobs;
+}
+
+/* Simulate the trace with `pageTrials` page mappings, of the successive seeds
+ * from `pageSeed`, as jobs of their own, and print the results of each and the
+ * spread of the misses among them. */
+static void runPageTrials() {
+    job_t *jobs = runJobs(pageTrials, runPageTrial);
+    uint64_t least = UINT64_MAX, most = 0, done = 0;
+    double sum = 0, squares = 0;
+
+    for (uint64_t i = 0; i < pageTrials; i++) {
+        uint64_t count = jobs[i].stats.misses;
+
+        if (!jobs[i].done) {
+            printf("page-seed:%" PRIu64 " error\n", pageSeed + i);
+            continue;
+        }
+
+        printf("page-seed:%" PRIu64 " hits:%" PRIu64 " misses:%" PRIu64
+               " evictions:%" PRIu64 "\n",
+               pageSeed + i, jobs[i].stats.hits, count,
+               jobs[i].stats.evictions);
+
+        least = count < least ? count : least;
+        most = count > most ? count : most;
+        sum += count;
+        squares += (double) count * count;
+        done++;
+    }
+
+    if (done > 0) {
+        double mean = sum / done, variance = squares / done - mean * mean;
+
+        printf("misses min:%" PRIu64 " max:%" PRIu64
+               " mean:%.1f stddev:%.1f\n",
+               least, most, mean, variance > 0 ? sqrt(variance) : 0);
+    }
+}
+
+/* Simulate the trace with the page mapping of the seed `pageSeed` + `job`. The
+ * trace is opened anew, since a forked process shares the file offset of the
+ * parent. */
+static void runPageTrial(size_t job) {
+    pageSeed += job;
+    streamJob = pageSeed;
+    openTrace(&mainTrace, tracePath);
+    trace = &mainTrace;
+    runSimulation();
+}
+
+/* Read the configurations of `batchPath`, which are the non-empty lines not
+ * starting with '#', and set `count` to the number of them. Exits the program
+ * if reading fails. */
+static char **readConfigs(size_t *count) {
+    FILE *fp = fopen(batchPath, "r");
+    char **configs = NULL, line[1024];
+
+    if (fp == NULL) {
+        printf("Error: failed to open file %s\n", batchPath);
+        exit(-1);
+    }
+
+    *count = 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (line[strspn(line, " \t")] == '\0' || line[0] == '#')
+            continue;
+
+        configs = (char **) realloc(configs, (*count + 1) * sizeof(char *));
+
+        if (configs == NULL || (configs[*count] = strdup(line)) == NULL) {
+            printf("Error: allocation failed\n");
+            exit(-1);
+        }
+
+        (*count)++;
+    }
+
+    fclose(fp);
+    return configs;
+}
+
+/* Simulate the trace of the job `job` of a batch with its configuration. It
+ * runs in a forked process of its own, so it may set up the globals as the
+ * command line of a single simulation would. */
+static void runBatchJob(size_t job) {
+    char *argv[64] = {"csim"};
+    char *copy = strdup(batchConfigs[job % batchConfigCount]);
+    int argc = 1;
+
+    if (copy == NULL) {
+        printf("Error: allocation failed\n");
+        exit(-1);
+    }
+
+    for (char *arg = strtok(copy, " \t"); arg != NULL && argc < 63;
+         arg = strtok(NULL, " \t"))
+        argv[argc++] = arg;
+
+    batchPath = NULL;
+    streamJob = job;
+    trace = &batchReaders[job / batchConfigCount];
+    optind = 0;
+    initTrace(argc, argv);
+    runSimulation();
+}
+
+/* Replay the traces of the tenants into `cache` in turn, `quantum` accesses of
+ * each at a time, until all of them end. The address of each access is tagged
+ * with its tenant so that the tenants never share a block. */
+static void runTenants(cache_t *cache) {
+    access_t access;
+    size_t running = tenantCount;
+
+    for (tenant = 0; running > 0; tenant = (tenant + 1) % tenantCount) {
+        if (tenants[tenant].done)
+            continue;
+
+        trace = &tenants[tenant].reader;
+        wayMask = tenants[tenant].mask;
+
+        for (uint64_t i = 0; i < quantum; i++) {
+            if (!nextAccess(&access)) {
+                tenants[tenant].done = true;
+                running--;
+                break;
+            }
+
+            access.addr |= (uint64_t) tenant << tenantShift;
+            processAccess(cache, &access);
+        }
+    }
+}
+
+/* Print the statistics of each tenant, and how many of its lines the other
+ * tenants evicted. */
+static void printTenants() {
+    for (size_t i = 0; i < tenantCount; i++) {
+        counter_t *stats = &tenants[i].stats;
+
+        printf("tenant:%zu hits:%" PRIu64 " misses:%" PRIu64
+               " evictions:%" PRIu64 " cross-evictions:%" PRIu64 " %s\n",
+               i, stats->hits, stats->misses, stats->evictions,
+               tenants[i].crossEvictions, tenants[i].path);
+    }
+}
+
+/* Initialize a fresh simulation cache using the configuration `indexBits` and
+ * `offsetBits`, and return the initialize cache object. */
+static cache_t *makeCache() {
+    cache_t *cache = (cache_t *) malloc(sizeof(cache_t));
+
+    if (cache == NULL) {
+        printf("Error: allocation failed\n");
+        exit(-1);
+    }
+
+    int size = sets * assoc;
+    int lines = size + victims;
+
+    /* All the arrays live in one block, in the same layout as a snapshot, so
+     * that saving and loading the state is a single copy. */
+    cache->size = size;
+    cache->victims = victims;
+    cache->mapped = 0;
+    cache->storage = calloc(lines, getLineBytes(sectors > 0));
+
+    if (cache->storage == NULL) {
+        printf("Error: allocation failed\n");
+        exit(-1);
+    }
+
+    layoutCache(cache, cache->storage, lines, sectors > 0);
+
+    /* The ranks in the set are initialized to 0, 1, 2, ... , assoc - 1. In
+     * other words, former lines in a set are considered as more recently
+     * updated. The victim entries are ranked likewise. */
+    for (int i = 0; i < size; i++)
+        cache->ranks[i] = i % assoc;
+
+    for (int i = 0; i < (int) victims; i++)
+        cache->ranks[size + i] = i;
+
+    return cache;
+}
+
+/* Return the number of bytes of the arrays per line of a cache, which is
+ * sectored if `sectored` is set. */
+static size_t getLineBytes(bool sectored) {
+    return (sectored ? 4 : 2) * sizeof(uint64_t) + 2 * sizeof(bool);
+}
+
+/* Point the arrays of `cache` into `arrays`, which holds the arrays of `lines`
+ * lines back to back: the tags, the ranks, the sector valid and dirty bits if
+ * `sectored` is set, and the valid and dirty bits last so that the rest stay
+ * aligned. */
+static void layoutCache(cache_t *cache, void *arrays, size_t lines,
+                        bool sectored) {
+    cache->tags = (uint64_t *) arrays;
+    cache->ranks = cache->tags + lines;
+    cache->sectorValid = sectored ? cache->ranks + lines : NULL;
+    cache->sectorDirty = sectored ? cache->sectorValid + lines : NULL;
+    cache->valid = (bool *) (cache->ranks + (sectored ? 3 : 1) * lines);
+    cache->dirty = cache->valid + lines;
+}
+
+/* Free the resources allocated for `cache`, including the cache object itself.
+ */
+static void destroyCache(cache_t *cache) {
+    assert(cache != NULL && cache->storage != NULL);
+
+    if (cache->mapped)
+        munmap(cache->storage, cache->mapped);
+    else
+        free(cache->storage);
+
+    free(cache);
+}
+
+/* Save the state of `cache`, along with the statistics and the trace position,
+ * into the snapshot file `path`. Exits the program if writing fails. */
+static void saveState(cache_t *cache, char path[]) {
+    assert(cache != NULL && path != NULL);
+
+    snapshot_t header = {.version = snapshotVersion,
+                         .indexBits = indexBits,
+                         .offsetBits = offsetBits,
+                         .victims = cache->victims,
+                         .indexing = indexing,
+                         .sectors = sectors,
+                         .sets = sets,
+                         .assoc = assoc,
+                         .position = position,
+                         .hits = hits,
+                         .misses = misses,
+                         .evictions = evictions,
+                         .victimHits = victimHits,
+                         .useClock = useClock,
+                         .sectorMisses = sectorMisses,
+                         .bytesFetched = bytesFetched,
+                         .bytesWritten = bytesWritten,
+                         .roiOpen = trace != NULL && trace->open,
+                         .roiEnded = trace != NULL && trace->ended,
+                         .traceSize = getTraceSize(),
+                         .warmup = warmup,
+                         .warmupBytes = warmupBytes,
+                         .interval = interval,
+                         .windows = windows,
+                         .windowAccesses = windowAccesses,
+                         .windowHits = windowHits,
+                         .windowMisses = windowMisses,
+                         .windowEvictions = windowEvictions};
+    memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+
+    size_t bytes = (cache->size + cache->victims) *
+                   getLineBytes(cache->sectorValid != NULL);
+    FILE *fp = fopen(path, "wb");
+
+    if (fp == NULL || fwrite(&header, sizeof(header), 1, fp) != 1 ||
+        fwrite(cache->tags, 1, bytes, fp) != bytes || fclose(fp) == EOF) {
+        printf("Error: failed to save the cache state to %s\n", path);
+        exit(-1);
+    }
+}
+
+/* Load the snapshot file `path` and return the cache stored in it. The
+ * statistics, the trace position and the cache geometry are restored as well.
+ * The file is mapped privately and used in place, so loading costs nothing
+ * beyond the pages the simulation actually touches. */
+static cache_t *loadState(char path[]) {
+    assert(path != NULL);
+
+    FILE *fp = fopen(path, "rb");
+    struct stat st;
+
+    if (fp == NULL || fstat(fileno(fp), &st) == -1) {
+        printf("Error: failed to open file %s\n", path);
+        exit(-1);
+    }
+
+    size_t length = st.st_size;
+    void *base = length < sizeof(snapshot_t)
+                     ? MAP_FAILED
+                     : mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                            fileno(fp), 0);
+    fclose(fp);
+
+    snapshot_t *header = (snapshot_t *) base;
+
+    if (base == MAP_FAILED ||
+        memcmp(header->magic, snapshotMagic, sizeof(header->magic)) != 0 ||
+        header->version != snapshotVersion) {
+        printf("Error: %s is not a valid snapshot\n", path);
+        exit(-1);
+    }
+
+    /* The geometry is checked as the options are before it sizes anything,
+     * and the lines must fill the rest of the file exactly. */
+    uint64_t sectorsMax = header->offsetBits < 6
+                              ? (uint64_t) 1 << header->offsetBits
+                              : 64;
+    uint64_t lineBytes = getLineBytes(header->sectors > 0);
+    uint64_t lines = header->sets * header->assoc + header->victims;
+
+    if (header->indexBits >= 64 || header->offsetBits >= 64 ||
+        header->indexBits + header->offsetBits > 64 ||
+        header->indexing > INDEX_SKEW || header->sets == 0 ||
+        header->assoc == 0 || header->assoc > INT_MAX ||
+        header->sets > INT_MAX / header->assoc ||
+        (header->indexing != INDEX_PRIME &&
+         header->sets != (uint64_t) 1 << header->indexBits) ||
+        (header->sectors & (header->sectors - 1)) != 0 ||
+        header->sectors > sectorsMax || lines > INT_MAX ||
+        length - sizeof(snapshot_t) != lines * lineBytes) {
+        printf("Error: %s is truncated or corrupted\n", path);
+        exit(-1);
+    }
+
+    size_t size = header->sets * header->assoc;
+
+    /* A geometry given on the command line must agree with the snapshot. */
+    if ((assoc != 0 &&
+         (indexBits != header->indexBits || assoc != header->assoc ||
+          offsetBits != header->offsetBits || indexing != header->indexing ||
+          sets != header->sets || sectors != header->sectors)) ||
+        (victims != 0 && victims != header->victims)) {
+        printf("Error: the cache geometry does not match %s\n", path);
+        exit(-1);
+    }
+
+    indexBits = header->indexBits;
+    offsetBits = header->offsetBits;
+    assoc = header->assoc;
+    victims = header->victims;
+    indexing = header->indexing;
+    sets = header->sets;
+    sectors = header->sectors;
+    useClock = header->useClock;
+    position = header->position;
+    hits = header->hits;
+    misses = header->misses;
+    evictions = header->evictions;
+    victimHits = header->victimHits;
+    sectorMisses = header->sectorMisses;
+    bytesFetched = header->bytesFetched;
+    bytesWritten = header->bytesWritten;
+    warmup = header->warmup;
+    warmupBytes = header->warmupBytes;
+
+    /* The windows go on where the saved simulation left them, so they must
+     * be as long as they were. */
+    if (interval > 0 && interval != header->interval) {
+        printf("Error: --interval does not match the interval of %s\n", path);
+        exit(-1);
+    }
+
+    if (interval > 0) {
+        windows = header->windows;
+        windowAccesses = header->windowAccesses;
+        windowHits = header->windowHits;
+        windowMisses = header->windowMisses;
+        windowEvictions = header->windowEvictions;
+    }
+
+    /* The saved position and region of interest only make sense in the trace
+     * they were saved on, which is told apart from others by its size. */
+    if (trace != NULL) {
+        uint64_t traceSize = getTraceSize();
+
+        if (offset == -1 && header->traceSize != 0 && traceSize != 0 &&
+            header->traceSize != traceSize) {
+            printf("Error: %s was saved on another trace; give -o to start "
+                   "this one from it\n",
+                   path);
+            exit(-1);
+        }
+
+        trace->open = header->roiOpen;
+        trace->ended = header->roiEnded;
+    }
+
+    cache_t *cache = (cache_t *) malloc(sizeof(cache_t));
+
+    if (cache == NULL) {
+        printf("Error: allocation failed\n");
+        exit(-1);
+    }
+
+    cache->size = size;
+    cache->victims = victims;
+    cache->storage = base;
+    cache->mapped = length;
+    layoutCache(cache, header + 1, lines, sectors > 0);
+
+    return cache;
+}
+
+/* Return the size in bytes of the trace being read, or 0 if it is unknown,
+ * such as for a pipe or the tenants. */
+static uint64_t getTraceSize() {
+    struct stat st;
+
+    if (trace == NULL)
+        return 0;
+
+    if (trace->data != NULL)
+        return trace->length;
+
+    if (fstat(fileno(trace->file), &st) == -1 || !S_ISREG(st.st_mode))
+        return 0;
+
+    return st.st_size;
+}
+
+/* Process one memory access, `access`, and updates the states of `cache`. */
+static void processAccess(cache_t *cache, access_t *access) {
+    assert(cache != NULL && access != NULL);
+
+    outcome_t outcome = {0};
+    uint64_t index = 0, line = 0, tag = getTag(access->addr);
+    bool found = false;
+
+    /* Check if there's any hit line. Each way of a skewed cache has its own
+     * set for the block, so it is probed separately. */
+    if (indexing == INDEX_SKEW) {
+        found = findSkewedLine(cache, tag, &line);
+    } else {
+        index = getIndex(access->addr) * assoc;
+
+        for (line = index; line < index + assoc; line++) {
+            if (cache->valid[line] && cache->tags[line] == tag) {
+                found = true;
+                break;
+            }
+        }
+    }
+
+    PROFILE_MARK(PHASE_PROBE);
+
+    /* If hit, update the ranks. If not hit, find the LRU line and update its
+     * validity and tag, and updates the ranks. With a victim cache, the LRU
+     * line is swapped with the victim entry of the accessed block, or moved
+     * into the victim cache if there's none. In a sectored cache, a tag hit
+     * still misses if any sector the access touches is not valid. */
+    if (found) {
+        if (cache->sectorValid != NULL && fillSectors(cache, line, access))
+            outcome.miss = outcome.sectorMiss = true;
+        else
+            outcome.hit++;
+
+        if (access->type != 'L')
+            cache->dirty[line] = true;
+
+        touchLine(cache, index, line);
+        recentLine = line;
+    } else {
+        uint64_t lru = indexing == INDEX_SKEW ? line
+                       : wayMask != UINT64_MAX
+                           ? findPartitionLine(cache, index)
+                           : findLRULine(cache, index, assoc);
+
+        if (cache->victims > 0) {
+            uint64_t block = access->addr >> offsetBits;
+            outcome.victimHit = swapVictim(cache, lru, block, &outcome);
+            outcome.miss = !outcome.victimHit;
+        } else {
+            outcome.miss = true;
+            outcome.evict = cache->valid[lru];
+
+            if (outcome.evict) {
+                outcome.evicted = getLineBlock(cache->tags[lru], lru);
+                outcome.writeback = cache->dirty[lru];
+                writeBack(cache, lru);
+            }
+        }
+
+        /* The line keeps the sectors of a block brought back from the victim
+         * cache, and starts empty otherwise. */
+        if (cache->sectorValid != NULL) {
+            if (!outcome.victimHit)
+                cache->sectorValid[lru] = cache->sectorDirty[lru] = 0;
+
+            fillSectors(cache, lru, access);
+        }
+
+        /* A line filled from memory starts clean, and a block brought back
+         * from the victim cache keeps its dirty bit. */
+        if (!outcome.victimHit)
+            cache->dirty[lru] = false;
+        if (access->type != 'L')
+            cache->dirty[lru] = true;
+
+        cache->valid[lru] = true;
+        cache->tags[lru] = tag;
+
+        touchLine(cache, index, lru);
+        recentLine = lru;
+    }
+
+    PROFILE_MARK(PHASE_REPLACE);
+
+    /* The eviction is written before the miss that causes it, and only the
+     * eviction of a dirty line writes the block back. */
+    if (streamfile != NULL) {
+        if (streamVictims && outcome.evict)
+            emitRecord('V', outcome.evicted);
+        if (outcome.writeback)
+            emitRecord('S', outcome.evicted);
+        if (outcome.miss)
+            emitRecord('L', access->addr >> offsetBits);
+    }
+
+    /* Also, if the access type is modification, add one more hit count since
+     * subsequent store access will be always hit. */
+    if (access->type == 'M')
+        outcome.hit++;
+
+    if (timing)
+        timeAccess(&outcome, access);
+
+    updateStat(&outcome, access);
+    PROFILE_MARK(PHASE_STATS);
+
+    if (diagnostics)
+        printAccess(&outcome, access);
+
+    if (state)
+        printCache(cache);
+
+    PROFILE_MARK(PHASE_OTHER);
+}
+
+/* Return the set index of the given address `addr`. For a skewed cache, it is
+ * the set of the first way. */
+static inline uint64_t getIndex(uint64_t addr) {
+    uint64_t block = addr >> offsetBits, mask = ((uint64_t) 1 << indexBits) - 1;
+    uint64_t index = 0;
+
+    switch (indexing) {
+    case INDEX_XOR:
+        for (; block != 0 && indexBits > 0; block >>= indexBits)
+            index ^= block & mask;
+        return index;
+    case INDEX_PRIME:
+        return block % sets;
+    case INDEX_SKEW:
+        return getSkewedIndex(block, 0);
+    default:
+        return block & mask;
+    }
+}
+
+/* Return the block offset of the given address `addr`. */
+static inline uint64_t getOffset(uint64_t addr) {
+    return addr & ((1 << offsetBits) - 1);
+};
+
+/* Return the tag of the given address `addr`. Hashed set indices don't leave
+ * the remaining bits of the address as a tag, so the tag is the whole block
+ * address for any index function but the plain set index bits. */
+static inline uint64_t getTag(uint64_t addr) {
+    if (indexing != INDEX_BITS)
+        return addr >> offsetBits;
+
+    return addr >> (offsetBits + indexBits);
+};
+
+/* Return the set index of the block address `block` in the way `way` of a
+ * skewed cache. The set index bits are XORed with a multiplicative hash of
+ * the tag bits, which is different for each way. */
+static inline uint64_t getSkewedIndex(uint64_t block, size_t way) {
+    if (indexBits == 0)
+        return 0;
+
+    uint64_t mask = ((uint64_t) 1 << indexBits) - 1;
+    uint64_t hash = (block >> indexBits) * (0x9e3779b97f4a7c15ULL ^ way << 1);
+    return (block ^ hash >> (64 - indexBits)) & mask;
+}
+
+/* Return the block address of the line `line` whose tag is `tag`. */
+static inline uint64_t getLineBlock(uint64_t tag, uint64_t line) {
+    if (indexing != INDEX_BITS)
+        return tag;
+
+    return tag << indexBits | line / assoc;
+}
+
+/* Return the largest prime number not greater than `limit`, or 1 if there is
+ * none. */
+static size_t findPrime(size_t limit) {
+    for (size_t n = limit; n > 1; n--) {
+        size_t d = 2;
+
+        while (d * d <= n && n % d != 0)
+            d++;
+
+        if (d * d > n)
+            return n;
+    }
+
+    return 1;
+}
+
+/* Update statistics according to the outcome of `access`. Note that the
+ * outcome holds the number of hits, instead of whether an access was hit, due
+ * to an modification access can hit twice. */
+static void updateStat(outcome_t *outcome, access_t *access) {
+    assert(outcome != NULL && access != NULL);
+    assert(0 <= outcome->hit && outcome->hit <= 2);
+
+    if (verbose) {
+        printf("%c %" PRIx64 ",%zu ", access->type, access->addr, access->size);
+
+        if (outcome->sectorMiss)
+            printf("sector-miss ");
+        else if (outcome->miss)
+            printf("miss ");
+        if (outcome->victimHit)
+            printf("victim-hit ");
+        if (outcome->evict)
+            printf("eviction ");
+        for (int i = 0; i < outcome->hit; i++)
+            printf("hit ");
+        printf("\n");
+    }
+
+    /* Accesses within the warm-up window only fill the cache; the statistics
+     * count from the first access after it. */
+    if (warmup > 0) {
+        uint64_t amount = warmupBytes ? access->size : 1;
+        warmup -= amount < warmup ? amount : warmup;
+        return;
+    }
+
+    if (outcome->miss)
+        misses++;
+    if (outcome->evict)
+        evictions++;
+    if (outcome->victimHit)
+        victimHits++;
+    if (outcome->sectorMiss)
+        sectorMisses++;
+    hits += outcome->hit;
+
+    if (tenantCount > 0) {
+        size_t owner = outcome->evicted >> (tenantShift - offsetBits);
+
+        countAccess(&tenants[tenant].stats, outcome);
+        if (outcome->evict && owner != tenant)
+            tenants[owner].crossEvictions++;
+    }
+
+    /* The breakdowns are only kept when they will be written out. */
+    if (setStats != NULL) {
+        countAccess(&typeStats[getTypeIndex(access->type)], outcome);
+        countAccess(&setStats[getIndex(access->addr)], outcome);
+
+        if (regionStats)
+            countAccess(findRegion(access->addr >> regionBits), outcome);
+    }
+
+    if (interval > 0) {
+        windowMisses += outcome->miss;
+        windowEvictions += outcome->evict;
+        windowHits += outcome->hit;
+
+        if (++windowAccesses == interval)
+            flushWindow();
+    }
+}
+
+/* Write the statistics of the current window as a CSV row and start a new
+ * window. The header row is written before the first window. */
+static void flushWindow() {
+    if (windows == 0)
+        fprintf(intervalfile, "window,accesses,hits,misses,evictions\n");
+
+    fprintf(intervalfile,
+            "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+            windows, windowAccesses, windowHits, windowMisses,
+            windowEvictions);
+
+    windows++;
+    windowAccesses = 0;
+    windowHits = windowMisses = windowEvictions = 0;
+}
+
+/* Return the index of `type` into `typeStats`. */
+static inline int getTypeIndex(char type) {
+    return type == 'L' ? 0 : type == 'S' ? 1 : 2;
+}
+
+/* Add one access with the given outcome to `counter`. */
+static void countAccess(counter_t *counter, outcome_t *outcome) {
+    counter->accesses++;
+    counter->hits += outcome->hit;
+    counter->misses += outcome->miss;
+    counter->evictions += outcome->evict;
+    counter->victimHits += outcome->victimHit;
+}
+
+/* Return the statistics of the region numbered `region`, adding a fresh entry
+ * for it if there is none. The table is open-addressed with linear probing,
+ * and doubles in size whenever it becomes half full. */
+static counter_t *findRegion(uint64_t region) {
+    if (2 * (regionCount + 1) > regionCapacity) {
+        region_t *old = regions;
+        size_t oldCapacity = regionCapacity;
+
+        regionCapacity = oldCapacity == 0 ? 1024 : 2 * oldCapacity;
+        regions = (region_t *) calloc(regionCapacity, sizeof(region_t));
+
+        if (regions == NULL) {
+            printf("Error: allocation failed\n");
+            exit(-1);
+        }
+
+        regionCount = 0;
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (old[i].used)
+                *findRegion(old[i].region) = old[i].stats;
+        }
+
+        free(old);
+    }
+
+    /* Multiplicative hashing spreads out the consecutive region numbers. */
+    size_t mask = regionCapacity - 1;
+    size_t i = (region * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+
+    while (regions[i].used && regions[i].region != region)
+        i = (i + 1) & mask;
+
+    if (!regions[i].used) {
+        regions[i].used = true;
+        regions[i].region = region;
+        regionCount++;
+    }
+
+    return &regions[i].stats;
+}
+
+/* Compare two entries of the region table by their region numbers. Unused
+ * entries are ordered last. */
+static int compareRegions(const void *a, const void *b) {
+    const region_t *x = (const region_t *) a, *y = (const region_t *) b;
+
+    if (x->used != y->used)
+        return x->used ? -1 : 1;
+
+    return (x->region > y->region) - (x->region < y->region);
+}
+
+/* Write one group of statistics as a JSON object or a CSV row. */
+static void writeCounter(FILE *fp, char scope[], char key[],
+                         counter_t *counter) {
+    if (statsCSV)
+        fprintf(fp, "%s,%s,", scope, key);
+    else
+        fprintf(fp, "{\"key\": \"%s\", ", key);
+
+    fprintf(fp,
+            statsCSV ? "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                       ",%" PRIu64 "\n"
+                     : "\"accesses\": %" PRIu64 ", \"hits\": %" PRIu64
+                       ", \"misses\": %" PRIu64 ", \"evictions\": %" PRIu64
+                       ", \"victim_hits\": %" PRIu64 "}",
+            counter->accesses, counter->hits, counter->misses,
+            counter->evictions, counter->victimHits);
+}
+
+/* Write the statistics, broken down by access type, by set and optionally by
+ * region, into `statsPath`. In JSON, each breakdown is an array of objects
+ * under the key of its name; in CSV, each row is tagged with the name of its
+ * breakdown in the first column. */
+static void writeStats() {
+    static char *typeNames[] = {"L", "S", "M"};
+    static char *scopes[] = {"total", "type", "set", "region"};
+    char key[32];
+    FILE *fp = fopen(statsPath, "w");
+
+    if (fp == NULL) {
+        printf("Error: failed to open file %s\n", statsPath);
+        exit(-1);
+    }
+
+    counter_t total = {0};
+    for (int i = 0; i < 3; i++) {
+        total.accesses += typeStats[i].accesses;
+        total.hits += typeStats[i].hits;
+        total.misses += typeStats[i].misses;
+        total.evictions += typeStats[i].evictions;
+        total.victimHits += typeStats[i].victimHits;
+    }
+
+    qsort(regions, regionCapacity, sizeof(region_t), compareRegions);
+
+    size_t counts[] = {1, 3, sets, regionCount};
+
+    if (statsCSV)
+        fprintf(fp, "scope,key,accesses,hits,misses,evictions,victim_hits\n");
+    else
+        fprintf(fp, "{\"s\": %zu, \"E\": %zu, \"b\": %zu", indexBits, assoc,
+                offsetBits);
+
+    for (int scope = 0; scope < 4; scope++) {
+        if (scope == 3 && !regionStats)
+            break;
+
+        if (!statsCSV)
+            fprintf(fp, ",\n \"%s\": [", scopes[scope]);
+
+        for (size_t i = 0; i < counts[scope]; i++) {
+            counter_t *counter = scope == 0   ? &total
+                                 : scope == 1 ? &typeStats[i]
+                                 : scope == 2 ? &setStats[i]
+                                              : &regions[i].stats;
+
+            if (scope == 0)
+                snprintf(key, sizeof(key), "all");
+            else if (scope == 1)
+                snprintf(key, sizeof(key), "%s", typeNames[i]);
+            else if (scope == 2)
+                snprintf(key, sizeof(key), "%zu", i);
+            else
+                snprintf(key, sizeof(key), "0x%" PRIx64,
+                         regions[i].region << regionBits);
+
+            if (!statsCSV && i > 0)
+                fprintf(fp, ",\n  ");
+
+            writeCounter(fp, scopes[scope], key, counter);
+        }
+
+        if (!statsCSV)
+            fprintf(fp, "]");
+    }
+
+    if (!statsCSV)
+        fprintf(fp, "}\n");
+
+    if (fclose(fp) == EOF) {
+        printf("Error: failed to close the file\n");
+        exit(-1);
+    }
+}
+
+#ifdef CSIM_PROFILE
+/* Return the current value of the cycle counter, or of a nanosecond clock on
+ * machines without one. */
+static inline uint64_t readTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/* Charge the ticks elapsed since the previous mark to `phase`. */
+static inline void markPhase(int phase) {
+    uint64_t now = readTicks();
+    phaseTicks[phase] += now - profileStamp;
+    profileStamp = now;
+}
+
+/* Print the share of the time spent in each phase and the throughput of the
+ * simulation. The ticks are converted to time with the wall clock time of the
+ * whole simulation. */
+static void printProfile() {
+    static const char *names[PHASES] = {"read",  "parse", "probe",
+                                        "replace", "stats", "other"};
+    struct timespec end;
+    uint64_t total = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for (int phase = 0; phase < PHASES; phase++)
+        total += phaseTicks[phase];
+
+    double seconds = (end.tv_sec - profileStart.tv_sec) +
+                     (end.tv_nsec - profileStart.tv_nsec) / 1e9;
+    uint64_t accesses = position - profileFirst;
+    double perAccess = accesses > 0 ? seconds * 1e9 / accesses : 0;
+
+    printf("Profile: %" PRIu64 " accesses in %.3f s (%.0f accesses/s)\n",
+           accesses, seconds, seconds > 0 ? accesses / seconds : 0);
+    printf("  Phase      Share  ns/access\n");
+
+    for (int phase = 0; phase < PHASES; phase++) {
+        double share = total > 0 ? (double) phaseTicks[phase] / total : 0;
+        printf("  %-8s %6.1f%% %10.1f\n", names[phase], share * 100,
+               share * perAccess);
+    }
+}
+#endif
+
+/* Updates LRU ranks of `cache` for cache access for `line` and the `ways`
+ * lines starting from `index`, which are either a set or the victim cache. It
+ * expects the ranks in `cache` are in valid state. i.e. the ranks are valid
+ * permutation of 0, 1, 2, ..., ways - 1. */
+static void updateRank(cache_t *cache, uint64_t index, size_t ways,
+                       uint64_t line) {
+    assert(cache != NULL && line >= index && line < index + ways);
+
+    /* Since `line` is already the least recently used line, there's no need
+     * to update ranks. */
+    if (cache->ranks[line] == 0)
+        return;
+
+    /* Increase ranks by one. */
+    for (size_t i = index; i < index + ways; i++) {
+        if (cache->ranks[i] < cache->ranks[line])
+            cache->ranks[i]++;
+    }
+
+    /* Finally, update the accessed line's rank to zero (most recently used). */
+    cache->ranks[line] = 0;
+}
+
+/* Find the least recently used line within the `ways` lines starting from
+ * `index` and returns the line number of the line. */
+static uint64_t findLRULine(cache_t *cache, uint64_t index, size_t ways) {
+    assert(cache != NULL && index + ways <= cache->size + cache->victims);
+
+    /* The line with rank of `ways` - 1 is the least recently used; find it and
+     * return it. */
+    for (size_t line = index; line < index + ways; line++) {
+        if (cache->ranks[line] == ways - 1)
+            return line;
+    }
+
+    /* This should not happen in principle, so install an assertion for
+     * debugging. */
+    assert(false);
+}
+
+/* Find the least recently used line of the set starting from `index` among the
+ * ways in the partition of the current tenant. */
+static uint64_t findPartitionLine(cache_t *cache, uint64_t index) {
+    uint64_t lru = UINT64_MAX;
+
+    for (size_t way = 0; way < assoc; way++) {
+        uint64_t line = index + way;
+
+        if (inPartition(way) &&
+            (lru == UINT64_MAX || cache->ranks[line] > cache->ranks[lru]))
+            lru = line;
+    }
+
+    assert(lru != UINT64_MAX);
+    return lru;
+}
+
+/* Return true if the current tenant may allocate into the way `way`. */
+static inline bool inPartition(size_t way) {
+    return way >= 64 || (wayMask >> way & 1);
+}
+
+/* Find the line of the block `block` in the skewed cache `cache`. Returns true
+ * and sets `line` to the line if it is found. Otherwise returns false and sets
+ * `line` to the line to replace, which is an invalid line of the block's sets
+ * if any, or else the least recently used of them, within the partition of the
+ * current tenant. */
+static bool findSkewedLine(cache_t *cache, uint64_t block, uint64_t *line) {
+    uint64_t oldest = UINT64_MAX;
+
+    for (size_t way = 0; way < assoc; way++) {
+        uint64_t candidate = getSkewedIndex(block, way) * assoc + way;
+
+        if (cache->valid[candidate] && cache->tags[candidate] == block) {
+            *line = candidate;
+            return true;
+        }
+
+        /* The use clock starts from 1, so invalid lines are the oldest. */
+        uint64_t used = cache->valid[candidate] ? cache->ranks[candidate] : 0;
+
+        if (used < oldest && inPartition(way)) {
+            oldest = used;
+            *line = candidate;
+        }
+    }
+
+    return false;
+}
+
+/* Make `line` of the set starting from `index` the most recently used. The
+ * lines of a skewed cache don't share their sets, so their ranks are the times
+ * of their last uses instead. */
+static inline void touchLine(cache_t *cache, uint64_t index, uint64_t line) {
+    if (indexing == INDEX_SKEW)
+        cache->ranks[line] = ++useClock;
+    else
+        updateRank(cache, index, assoc, line);
+}
+
+/* Move `line`, which is about to be replaced by the block at block address
+ * `block`, into the victim cache. If the victim cache holds `block`, the two
+ * swap places and true is returned. Otherwise `line` takes the place of the
+ * LRU victim entry, recording the eviction in `outcome` if that entry was
+ * valid, and false is returned. Either way `line` is free to be overwritten
+ * afterwards. */
+static bool swapVictim(cache_t *cache, uint64_t line, uint64_t block,
+                       outcome_t *outcome) {
+    uint64_t first = cache->size, entry;
+    bool hit = false;
+
+    for (entry = first; entry < first + cache->victims; entry++) {
+        if (cache->valid[entry] && cache->tags[entry] == block) {
+            hit = true;
+            break;
+        }
+    }
+
+    if (!hit)
+        entry = findLRULine(cache, first, cache->victims);
+
+    outcome->evict = !hit && cache->valid[line] && cache->valid[entry];
+
+    if (outcome->evict) {
+        outcome->evicted = cache->tags[entry];
+        outcome->writeback = cache->dirty[entry];
+        writeBack(cache, entry);
+    }
+
+    /* The dirty bits and the sectors travel with their blocks. */
+    bool dirty = cache->dirty[entry];
+
+    cache->dirty[entry] = cache->dirty[line];
+    cache->dirty[line] = dirty;
+
+    if (cache->sectorValid != NULL) {
+        uint64_t sectorValid = cache->sectorValid[entry];
+        uint64_t sectorDirty = cache->sectorDirty[entry];
+
+        cache->sectorValid[entry] = cache->sectorValid[line];
+        cache->sectorDirty[entry] = cache->sectorDirty[line];
+        cache->sectorValid[line] = sectorValid;
+        cache->sectorDirty[line] = sectorDirty;
+    }
+
+    if (cache->valid[line]) {
+        cache->tags[entry] = getLineBlock(cache->tags[line], line);
+        cache->valid[entry] = true;
+        updateRank(cache, first, cache->victims, entry);
+    } else if (hit) {
+        cache->valid[entry] = false;
+    }
+
+    return hit;
+}
+
+/* Mark the sectors of `line` that `access` touches as valid, and also as dirty
+ * unless it is a load, fetching the ones that were not valid. The access is
+ * clipped to the block of its address. Returns true if any sector had to be
+ * fetched. */
+static bool fillSectors(cache_t *cache, uint64_t line, access_t *access) {
+    size_t sectorBytes = ((size_t) 1 << offsetBits) / sectors;
+    uint64_t offset = getOffset(access->addr);
+    uint64_t first = offset / sectorBytes;
+    uint64_t last = (offset + (access->size > 0 ? access->size : 1) - 1) /
+                    sectorBytes;
+
+    if (last >= sectors)
+        last = sectors - 1;
+
+    uint64_t width = last - first + 1;
+    uint64_t touched =
+        width == 64 ? UINT64_MAX : (((uint64_t) 1 << width) - 1) << first;
+    uint64_t missing = touched & ~cache->sectorValid[line];
+
+    cache->sectorValid[line] |= touched;
+    if (access->type != 'L')
+        cache->sectorDirty[line] |= touched;
+
+    if (warmup == 0)
+        bytesFetched += __builtin_popcountll(missing) * sectorBytes;
+
+    return missing != 0;
+}
+
+/* Account for writing back the dirty sectors of `line`, which is about to
+ * leave the cache. Only a sectored cache tracks dirty data. */
+static void writeBack(cache_t *cache, uint64_t line) {
+    if (cache->sectorDirty == NULL || warmup > 0)
+        return;
+
+    bytesWritten += __builtin_popcountll(cache->sectorDirty[line]) *
+                    (((size_t) 1 << offsetBits) / sectors);
+}
+
+/* Open the miss stream file of this simulation, allocate its buffers and
+ * start its writer thread. Each simulation opens its own, since the jobs and
+ * page trials run in forked processes that share neither the thread nor the
+ * file; their streams go to `streamPath` suffixed with the number of the job
+ * or the seed of the trial. Exits the program if opening fails. */
+static void openStream() {
+    char path[4096];
+
+    if (streamJob == -1)
+        snprintf(path, sizeof(path), "%s", streamPath);
+    else
+        snprintf(path, sizeof(path), "%s.%" PRId64, streamPath, streamJob);
+
+    if ((streamfile = fopen(path, "wb")) == NULL) {
+        printf("Error: failed to open file %s\n", path);
+        exit(-1);
+    }
+
+    streamBuffers[0] = (char *) malloc(streamCapacity);
+    streamBuffers[1] = (char *) malloc(streamCapacity);
+
+    if (streamBuffers[0] == NULL || streamBuffers[1] == NULL) {
+        printf("Error: allocation failed\n");
+        exit(-1);
+    }
+
+    if (streamBinary)
+        memcpy(streamBuffers[0], TRACE_MAGIC, TRACE_MAGIC_SIZE);
+
+    streamLengths[0] = streamBinary ? TRACE_MAGIC_SIZE : 0;
+    streamLengths[1] = 0;
+    streamFill = 0;
+    streamFull = -1;
+    streamClosing = streamFailed = false;
+
+    if (pthread_create(&streamThread, NULL, writeStream, NULL) != 0) {
+        printf("Error: failed to start the miss stream writer\n");
+        exit(-1);
+    }
+}
+
+/* The writer thread of the miss stream. It writes each buffer handed over by
+ * `flushStream` while the simulation fills the other one, until the stream is
+ * closed. */
+static void *writeStream(void *arg) {
+    pthread_mutex_lock(&streamLock);
+
+    for (;;) {
+        while (streamFull == -1 && !streamClosing)
+            pthread_cond_wait(&streamCond, &streamLock);
+
+        if (streamFull == -1)
+            break;
+
+        int full = streamFull;
+        pthread_mutex_unlock(&streamLock);
+
+        if (fwrite(streamBuffers[full], 1, streamLengths[full], streamfile) !=
+            streamLengths[full])
+            streamFailed = true;
+
+        pthread_mutex_lock(&streamLock);
+        streamLengths[full] = 0;
+        streamFull = -1;
+        pthread_cond_broadcast(&streamCond);
+    }
+
+    pthread_mutex_unlock(&streamLock);
+    return arg;
+}
+
+/* Append an access of type `type` to the whole block at block address `block`
+ * to the miss stream, in the format of the stream. A victim record, of type
+ * 'V', is written like a valgrind instruction line, without the leading space
+ * of the data accesses, so that the trace readers skip it. */
+static void emitRecord(char type, uint64_t block) {
+    char *buf = streamBuffers[streamFill];
+    size_t *length = &streamLengths[streamFill];
+
+    if (streamBinary) {
+        trace_record_t record = {.addr = block << offsetBits,
+                                 .size = 1 << offsetBits,
+                                 .type = type};
+
+        memcpy(buf + *length, &record, sizeof(record));
+        *length += sizeof(record);
+    } else {
+        *length += sprintf(buf + *length, "%s%c %" PRIx64 ",%u\n",
+                           type == 'V' ? "" : " ", type, block << offsetBits,
+                           1 << offsetBits);
+    }
+
+    /* A text record takes at most 2 + 16 + 1 + 10 + 1 bytes. */
+    if (streamCapacity - *length < 64)
+        flushStream();
+}
+
+/* Hand the buffer being filled over to the writer thread, waiting for it to
+ * finish writing the other one first, and continue with the other buffer. */
+static void flushStream() {
+    pthread_mutex_lock(&streamLock);
+
+    while (streamFull != -1)
+        pthread_cond_wait(&streamCond, &streamLock);
+
+    streamFull = streamFill;
+    streamFill ^= 1;
+    pthread_cond_broadcast(&streamCond);
+    pthread_mutex_unlock(&streamLock);
+}
+
+/* Write out the rest of the miss stream, stop the writer thread and close the
+ * file. Exits the program if writing failed. */
+static void closeStream() {
+    if (streamLengths[streamFill] > 0)
+        flushStream();
+
+    pthread_mutex_lock(&streamLock);
+    streamClosing = true;
+    pthread_cond_broadcast(&streamCond);
+    pthread_mutex_unlock(&streamLock);
+    pthread_join(streamThread, NULL);
+
+    if (streamFailed || fclose(streamfile) == EOF) {
+        printf("Error: failed to write the miss stream\n");
+        exit(-1);
+    }
+
+    free(streamBuffers[0]);
+    free(streamBuffers[1]);
+    streamfile = NULL;
+}
+
+/* Initialize the MSHRs and the occupancy histogram of the timing model. */
+static void makeTiming() {
+    mshrs = (mshr_t *) calloc(mshrCount, sizeof(mshr_t));
+    occupancy = (uint64_t *) calloc(mshrCount + 1, sizeof(uint64_t));
+
+    if (mshrs == NULL || occupancy == NULL) {
+        printf("Error: allocation failed\n");
+        exit(-1);
+    }
+}
+
+/* Issue `access` with the given outcome to the timing model. Accesses issue in
+ * order, one per cycle. A miss allocates an MSHR, stalling the issue until one
+ * is free, and completes after the memory latency once the memory bus is free.
+ * The latency of an access counts from its issue, including any stall.
+ * An access to a block with an outstanding miss, which the functional model
+ * already counts as a hit, is merged into its MSHR and completes with it. */
+static void timeAccess(outcome_t *outcome, access_t *access) {
+    uint64_t block = access->addr >> offsetBits, issue = cycle, latency;
+    mshr_t *pending = NULL, *free = NULL;
+
+    advanceTime(cycle);
+
+    for (size_t i = 0; i < mshrCount; i++) {
+        if (mshrs[i].done > cycle && mshrs[i].block == block)
+            pending = &mshrs[i];
+        else if (mshrs[i].done <= cycle && free == NULL)
+            free = &mshrs[i];
+    }
+
+    if (pending != NULL) {
+        latency = pending->done - cycle;
+        latency = latency > hitLatency ? latency : hitLatency;
+        mergedMisses += warmup == 0;
+    } else if (outcome->miss) {
+        /* All MSHRs are busy; stall until the earliest one completes. */
+        if (free == NULL) {
+            free = &mshrs[0];
+            for (size_t i = 1; i < mshrCount; i++) {
+                if (mshrs[i].done < free->done)
+                    free = &mshrs[i];
+            }
+
+            stallCycles += warmup == 0 ? free->done - cycle : 0;
+            cycle = free->done;
+            advanceTime(cycle);
+        }
+
+        uint64_t start = busFree > cycle ? busFree : cycle;
+        if (bandwidth > 0)
+            busFree = start + ((1 << offsetBits) + bandwidth - 1) / bandwidth;
+
+        free->block = block;
+        free->done = start + memoryLatency;
+        latency = free->done - issue;
+    } else {
+        latency = outcome->victimHit ? victimLatency : hitLatency;
+    }
+
+    /* Accesses within the warm-up window only advance the time. */
+    if (warmup == 0) {
+        if (timedAccesses == 0)
+            startCycle = issue;
+
+        latencies += latency;
+        timedAccesses++;
+    }
+
+    if (issue + latency > finishCycle)
+        finishCycle = issue + latency;
+
+    cycle++;
+}
+
+/* Advance the occupancy histogram up to the cycle `until`. The number of busy
+ * MSHRs only drops in between, as misses complete. */
+static void advanceTime(uint64_t until) {
+    while (histCycle < until) {
+        uint64_t next = until;
+        size_t busy = 0;
+
+        for (size_t i = 0; i < mshrCount; i++) {
+            if (mshrs[i].done > histCycle) {
+                busy++;
+                next = mshrs[i].done < next ? mshrs[i].done : next;
+            }
+        }
+
+        if (warmup == 0)
+            occupancy[busy] += next - histCycle;
+
+        histCycle = next;
+    }
+}
+
+/* Print the estimated cycles, the average memory access time and the MSHR
+ * occupancy histogram of the counted accesses. */
+static void printTiming() {
+    advanceTime(finishCycle);
+
+    uint64_t cycles = timedAccesses > 0 ? finishCycle - startCycle : 0;
+
+    printf("cycles:%" PRIu64 " amat:%.2f merged:%" PRIu64
+           " stall-cycles:%" PRIu64 "\n",
+           cycles, timedAccesses > 0 ? (double) latencies / timedAccesses : 0,
+           mergedMisses, stallCycles);
+    printf("mshr-occupancy:");
+
+    for (size_t i = 0; i <= mshrCount; i++)
+        printf(" %zu:%" PRIu64, i, occupancy[i]);
+
+    printf("\n");
+}
+
+/* Clean up the used resources. */
+static void finalizeTrace() {
+    for (size_t i = 0; i < tenantCount; i++) {
+        if (fclose(tenants[i].reader.file) == EOF) {
+            printf("Error: failed to close the file\n");
+            exit(-1);
+        }
+    }
+
+    free(tenants);
+
+    if ((mainTrace.file != NULL && fclose(mainTrace.file) == EOF) ||
+        (intervalfile != NULL && intervalfile != stderr &&
+         fclose(intervalfile) == EOF)) {
         printf("Error: failed to close the file\n");
         exit(-1);
     }
@@ -361,15 +3253,28 @@ static void printCache(cache_t *cache) {
                cache->tags[line], cache->ranks[line]);
     }
 
+    if (cache->victims > 0) {
+        printf("Victim cache status:\n");
+        printf("  Entry Valid      Block Rank\n");
+    }
+
+    for (size_t line = cache->size; line < cache->size + cache->victims;
+         line++) {
+        printf("  %5zu %5d 0x%08" PRIx64 " %4" PRIu64 "\n", line - cache->size,
+               cache->valid[line], cache->tags[line], cache->ranks[line]);
+    }
+
     printf("\n");
 }
 
 /* Print the diagnostics of `access`. */
-static void printAccess(int hit, bool miss, bool evict, access_t *access) {
+static void printAccess(outcome_t *outcome, access_t *access) {
     printf("Access diagnostics:\n");
-    printf("    Hits:    %d\n", hit);
-    printf("    Miss:    %s\n", miss ? "true" : "false");
-    printf("    Evict:   %s\n", evict ? "true" : "false");
+    printf("    Hits:    %d\n", outcome->hit);
+    printf("    Miss:    %s\n", outcome->miss ? "true" : "false");
+    printf("    Evict:   %s\n", outcome->evict ? "true" : "false");
+    if (victims > 0)
+        printf("    Victim:  %s\n", outcome->victimHit ? "true" : "false");
     printf("    Type:    %c\n", access->type);
     printf("    Address: 0x%08" PRIx64 "\n", access->addr);
     printf("    Size:    %zu\n", access->size);
@@ -0,0 +1,47 @@
+/*
+ * csim.h - Interface of the cache simulator linked into other programs
+ *
+ * Compiling csim.c with CSIM_LIBRARY renames its main() to csimMain() and
+ * makes the cache model usable without a trace file: csimBegin() makes a
+ * cache, each csimAccess() simulates one access on it, csimReplay() and
+ * csimReplayFile() simulate a trace held in memory or read from a stream, and
+ * csimEnd() returns the statistics and frees the cache. Only one cache may be
+ * simulated at a time.
+ */
+
+#ifndef CACHELAB_CSIM_H
+#define CACHELAB_CSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* A range of addresses, from `low` up to but not including `high` */
+typedef struct {
+    uint64_t low;
+    uint64_t high;
+} range_t;
+
+/* The command line entry point of csim */
+int csimMain(int argc, char *argv[]);
+
+/* Start simulating a cache of 2^s sets of E lines of 2^b bytes */
+void csimBegin(int s, int E, int b);
+
+/* Simulate an access of the given type ('L', 'S' or 'M'), address and size */
+void csimAccess(char type, uint64_t addr, size_t size);
+
+/* Simulate the accesses of the trace of `length` bytes at `data` from the one
+   to the `start` marker through the one to the `end` marker that are within
+   any of the `count` ranges of `ranges`, or all of them if `count` is 0 */
+void csimReplay(const char *data, size_t length, uint64_t start, uint64_t end,
+                const range_t ranges[], size_t count);
+
+/* Likewise for the valgrind trace read from `fp`, up to the `end` marker */
+void csimReplayFile(FILE *fp, uint64_t start, uint64_t end,
+                    const range_t ranges[], size_t count);
+
+/* Finish the simulation and store its statistics */
+void csimEnd(int *hits, int *misses, int *evictions);
+
+#endif /* CACHELAB_CSIM_H */
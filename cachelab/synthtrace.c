@@ -0,0 +1,426 @@
+/*
+ * synthtrace.c - Generates synthetic memory traces for stress testing and
+ *     benchmarking the cache simulator.
+ *
+ * Each workload emits a stream of data accesses, either in the valgrind
+ * trace format or in the binary format of tracefmt.h. The stream is fully
+ * determined by the workload parameters and the seed. Apart from the
+ * pointer-chasing cycle, the memory used does not depend on the number of
+ * records, so traces of billions of records can be generated directly into
+ * a file or a pipe.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefmt.h"
+
+static const char usage[] =
+    "Usage: %s [-h] -w <workload> -n <records> [options]\n"
+    "Options:\n"
+    "   -h             Display this usage info and quit.\n"
+    "   -w <workload>  Workload to generate (see below).\n"
+    "   -n <records>   Number of accesses to generate.\n"
+    "   -s <seed>      Seed of the random number generator (default 1).\n"
+    "   -f <format>    Output format, text or binary (default text).\n"
+    "   -o <file>      Output file (default stdout).\n"
+    "   -S <bytes>     Footprint of the workload (default 1M).\n"
+    "   -e <bytes>     Size of an element (default 4).\n"
+    "   -k <bytes>     Stride of the stride workload (default 64).\n"
+    "   -z <theta>     Exponent of the zipf workload, 0 < theta < 1 "
+    "(default 0.99).\n"
+    "   -p <percent>   Percentage of stores of the seq, stride, random and\n"
+    "                  zipf workloads (default 0).\n"
+    "   -a <addr>      Base address of the footprint (default 0x10000000).\n"
+    "Sizes accept a K, M or G suffix.\n"
+    "Workloads:\n"
+    "   seq            Sequential scan over the footprint.\n"
+    "   stride         Strided scan over the footprint.\n"
+    "   random         Uniformly random elements of the footprint.\n"
+    "   zipf           Zipfian random elements; element i is the i-th most\n"
+    "                  popular, so the hot set is at the start.\n"
+    "   chase          Pointer chasing along a random cycle of elements.\n"
+    "   stencil        5-point stencil sweeps between two square grids.\n"
+    "   transpose      Row-wise transposes of a square matrix into another.\n";
+
+static char *workload = NULL;      // The workload to generate.
+static uint64_t records = 0;       // The number of accesses to generate.
+static uint64_t seed = 1;          // Seed of the random number generator.
+static bool binary = false;        // Should the output be a binary trace?
+static FILE *outfile = NULL;       // The file to write the trace into.
+static uint64_t footprint = 1 << 20; // Footprint of the workload in bytes.
+static uint64_t elemSize = 4;        // Size of an element in bytes.
+static uint64_t stride = 64;         // Stride of the stride workload.
+static double theta = 0.99;          // Exponent of the zipf workload.
+static int storePercent = 0;         // Percentage of stores.
+static uint64_t base = 0x10000000;   // Base address of the footprint.
+
+static uint64_t emitted = 0; // The number of accesses emitted so far.
+static uint64_t rngState;    // State of the random number generator.
+static char output[1 << 16]; // Output buffer.
+static size_t outputSize = 0; // The number of bytes in `output`.
+
+static uint64_t getSizeArg(char arg[], char prog[]);
+static uint64_t nextRandom();
+static void emit(char type, uint64_t addr);
+static void flushOutput();
+static char randomType();
+static void genSeq();
+static void genStride();
+static void genRandom();
+static void genZipf();
+static void genChase();
+static void genStencil();
+static void genTranspose();
+
+int main(int argc, char *argv[]) {
+    int ch;
+    char *format = "text";
+
+    outfile = stdout;
+
+    while ((ch = getopt(argc, argv, "hw:n:s:f:o:S:e:k:z:p:a:")) != -1) {
+        switch (ch) {
+        case 'h':
+            printf(usage, argv[0]);
+            exit(0);
+        case 'w':
+            workload = optarg;
+            break;
+        case 'n':
+            records = getSizeArg("n", argv[0]);
+            break;
+        case 's':
+            seed = getSizeArg("s", argv[0]);
+            break;
+        case 'f':
+            format = optarg;
+            break;
+        case 'o':
+            if ((outfile = fopen(optarg, "wb")) == NULL) {
+                printf("Error: failed to open file %s\n", optarg);
+                exit(-1);
+            }
+
+            break;
+        case 'S':
+            footprint = getSizeArg("S", argv[0]);
+            break;
+        case 'e':
+            elemSize = getSizeArg("e", argv[0]);
+            break;
+        case 'k':
+            stride = getSizeArg("k", argv[0]);
+            break;
+        case 'z':
+            theta = atof(optarg);
+            break;
+        case 'p':
+            storePercent = (int) getSizeArg("p", argv[0]);
+            break;
+        case 'a':
+            base = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            printf(usage, argv[0]);
+            exit(-1);
+        }
+    }
+
+    if (workload == NULL || records == 0) {
+        printf("Error: missing required argument\n");
+        printf(usage, argv[0]);
+        exit(-1);
+    }
+
+    if (strcmp(format, "text") != 0 && strcmp(format, "binary") != 0) {
+        printf("Error: unknown format %s\n", format);
+        exit(-1);
+    }
+
+    if (elemSize == 0 || footprint < elemSize || stride == 0 ||
+        theta <= 0 || theta >= 1 || storePercent > 100) {
+        printf("Error: invalid workload parameters\n");
+        exit(-1);
+    }
+
+    binary = strcmp(format, "binary") == 0;
+    rngState = seed;
+
+    if (binary) {
+        memcpy(output, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+        outputSize = TRACE_MAGIC_SIZE;
+    }
+
+    if (strcmp(workload, "seq") == 0)
+        genSeq();
+    else if (strcmp(workload, "stride") == 0)
+        genStride();
+    else if (strcmp(workload, "random") == 0)
+        genRandom();
+    else if (strcmp(workload, "zipf") == 0)
+        genZipf();
+    else if (strcmp(workload, "chase") == 0)
+        genChase();
+    else if (strcmp(workload, "stencil") == 0)
+        genStencil();
+    else if (strcmp(workload, "transpose") == 0)
+        genTranspose();
+    else {
+        printf("Error: unknown workload %s\n", workload);
+        exit(-1);
+    }
+
+    flushOutput();
+
+    if (fclose(outfile) == EOF) {
+        printf("Error: failed to close the file\n");
+        exit(-1);
+    }
+
+    return 0;
+}
+
+/* Parses a non-negative command-line integer argument with an optional K, M or
+ * G suffix. `arg` is the name of the argument, and `prog` is the program name.
+ * Exits the program if the argument is ill-formed. */
+static uint64_t getSizeArg(char arg[], char prog[]) {
+    char *end;
+
+    errno = 0;
+    long long retval = strtoll(optarg, &end, 0);
+
+    if (*end == 'K')
+        retval <<= 10;
+    else if (*end == 'M')
+        retval <<= 20;
+    else if (*end == 'G')
+        retval <<= 30;
+
+    if (errno != 0 || retval < 0 || end == optarg ||
+        *(end + (*end != '\0')) != '\0') {
+        printf("Error: invalid format of argument %s\n", arg);
+        printf(usage, prog);
+        exit(-1);
+    }
+
+    return retval;
+}
+
+/* Return the next number of the xorshift64* generator. */
+static uint64_t nextRandom() {
+    /* A zero state would be stuck at zero; mix the seed once instead. */
+    if (rngState == 0)
+        rngState = 0x9e3779b97f4a7c15ULL;
+
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545f4914f6cdd1dULL;
+}
+
+/* Return the type of a read-or-write access according to `storePercent`. */
+static char randomType() {
+    if (storePercent == 0)
+        return 'L';
+
+    return (int) (nextRandom() % 100) < storePercent ? 'S' : 'L';
+}
+
+/* Append an access of one element at `addr` to the output, unless enough
+ * accesses have been emitted already. */
+static void emit(char type, uint64_t addr) {
+    if (emitted == records)
+        return;
+
+    emitted++;
+
+    if (outputSize + 64 > sizeof(output))
+        flushOutput();
+
+    if (binary) {
+        trace_record_t record = {.addr = addr, .size = elemSize, .type = type};
+        memcpy(output + outputSize, &record, sizeof(record));
+        outputSize += sizeof(record);
+        return;
+    }
+
+    /* Formatting by hand is several times faster than fprintf. */
+    char digits[32];
+    int count = 0;
+
+    do {
+        digits[count++] = "0123456789abcdef"[addr & 0xf];
+        addr >>= 4;
+    } while (addr != 0);
+
+    output[outputSize++] = ' ';
+    output[outputSize++] = type;
+    output[outputSize++] = ' ';
+    while (count > 0)
+        output[outputSize++] = digits[--count];
+    outputSize += sprintf(output + outputSize, ",%" PRIu64 "\n", elemSize);
+}
+
+/* Write out the buffered output. */
+static void flushOutput() {
+    if (fwrite(output, 1, outputSize, outfile) != outputSize) {
+        printf("Error: failed to write the trace\n");
+        exit(-1);
+    }
+
+    outputSize = 0;
+}
+
+/* Sequential scan, wrapping around the footprint. */
+static void genSeq() {
+    uint64_t elems = footprint / elemSize;
+
+    for (uint64_t i = 0; emitted < records; i = (i + 1) % elems)
+        emit(randomType(), base + i * elemSize);
+}
+
+/* Strided scan, wrapping around the footprint. After each wrap-around the scan
+ * starts one element further, so that all elements are eventually touched. */
+static void genStride() {
+    uint64_t offset = 0, start = 0;
+
+    while (emitted < records) {
+        emit(randomType(), base + offset);
+
+        offset += stride;
+        if (offset + elemSize > footprint) {
+            start = (start + elemSize) % stride;
+            offset = start;
+        }
+    }
+}
+
+/* Uniformly random elements. */
+static void genRandom() {
+    uint64_t elems = footprint / elemSize;
+
+    while (emitted < records)
+        emit(randomType(), base + nextRandom() % elems * elemSize);
+}
+
+/* Zipfian random elements, drawn with the method of Gray et al., "Quickly
+ * generating billion-record synthetic databases". It costs O(n) to set up and
+ * O(1) per element. */
+static void genZipf() {
+    uint64_t elems = footprint / elemSize;
+    double zetan = 0;
+
+    for (uint64_t i = 1; i <= elems; i++)
+        zetan += 1 / pow((double) i, theta);
+
+    double zeta2 = 1 + pow(0.5, theta);
+    double alpha = 1 / (1 - theta);
+    double eta = (1 - pow(2.0 / elems, 1 - theta)) / (1 - zeta2 / zetan);
+
+    while (emitted < records) {
+        double u = (nextRandom() >> 11) * 0x1.0p-53;
+        double uz = u * zetan;
+        uint64_t rank;
+
+        if (uz < 1)
+            rank = 0;
+        else if (uz < zeta2)
+            rank = 1;
+        else
+            rank = (uint64_t) (elems * pow(eta * u - eta + 1, alpha));
+
+        emit(randomType(), base + (rank < elems ? rank : elems - 1) * elemSize);
+    }
+}
+
+/* Pointer chasing along a single random cycle through all the elements, built
+ * with Sattolo's algorithm, so that no element is revisited before all the
+ * others are. */
+static void genChase() {
+    uint64_t elems = footprint / elemSize;
+    uint64_t *next = (uint64_t *) malloc(elems * sizeof(uint64_t));
+
+    if (next == NULL) {
+        printf("Error: allocation failed\n");
+        exit(-1);
+    }
+
+    for (uint64_t i = 0; i < elems; i++)
+        next[i] = i;
+
+    for (uint64_t i = elems - 1; i > 0; i--) {
+        uint64_t j = nextRandom() % i;
+        uint64_t tmp = next[i];
+        next[i] = next[j];
+        next[j] = tmp;
+    }
+
+    for (uint64_t i = 0; emitted < records; i = next[i])
+        emit('L', base + i * elemSize);
+
+    free(next);
+}
+
+/* 5-point stencil sweeps. Each sweep reads the four neighbours and the center
+ * of each interior point of one grid and writes the point of the other grid;
+ * the grids swap their roles after each sweep. */
+static void genStencil() {
+    uint64_t dim = (uint64_t) sqrt((double) (footprint / elemSize / 2));
+    uint64_t row = dim * elemSize;
+    uint64_t src = base, dst = base + dim * row;
+
+    if (dim < 3) {
+        printf("Error: footprint too small for the stencil workload\n");
+        exit(-1);
+    }
+
+    while (emitted < records) {
+        for (uint64_t i = 1; i < dim - 1 && emitted < records; i++) {
+            for (uint64_t j = 1; j < dim - 1 && emitted < records; j++) {
+                uint64_t center = i * row + j * elemSize;
+
+                emit('L', src + center - row);
+                emit('L', src + center - elemSize);
+                emit('L', src + center);
+                emit('L', src + center + elemSize);
+                emit('L', src + center + row);
+                emit('S', dst + center);
+            }
+        }
+
+        uint64_t tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+}
+
+/* Row-wise transposes of a square matrix A into B, i.e. the access pattern of
+ * the baseline trans() of trans.c. */
+static void genTranspose() {
+    uint64_t dim = (uint64_t) sqrt((double) (footprint / elemSize / 2));
+    uint64_t row = dim * elemSize;
+    uint64_t a = base, b = base + dim * row;
+
+    if (dim == 0) {
+        printf("Error: footprint too small for the transpose workload\n");
+        exit(-1);
+    }
+
+    while (emitted < records) {
+        for (uint64_t i = 0; i < dim && emitted < records; i++) {
+            for (uint64_t j = 0; j < dim && emitted < records; j++) {
+                emit('L', a + i * row + j * elemSize);
+                emit('S', b + j * row + i * elemSize);
+            }
+        }
+    }
+}
@@ -3,28 +3,48 @@
  *     student's transpose functions and records the results for their
  *     official submitted version as well.
  */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 #include "cachelab.h"
+#include "csim.h"
 #include <assert.h>
+#include <errno.h>
 #include <getopt.h>
-#include <limits.h> // for INT_MAX
+#include <immintrin.h> // for _mm_clflush
+#include <limits.h>    // for INT_MAX
+#include <linux/perf_event.h>
 #include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h> // fir WEXITSTATUS
+#include <time.h>
 #include <unistd.h>
 
-/* Maximum array dimension */
-#define MAXN 256
-
 /* The description string for the transpose_submit() function that the
    student submits for credit */
 #define SUBMIT_DESCRIPTION "Transpose submission"
 
+/* The most address ranges tracegen may list on its MARKERS line */
+#define MAX_RANGES 16
+
 /* External function defined in trans.c */
 extern void registerFunctions();
 
+/* registerFunctions() of the optimized copy of trans.c that is timed, which
+   registers its functions with registerTimedFunction() */
+extern void registerTimedFunctions();
+
+/* The threads of the parallel transposes of the timed copy */
+extern int timedTransposeThreads;
+
 /* External variables defined in cachelab-tools.c */
 extern trans_func_t func_list[MAX_TRANS_FUNCS];
 extern int func_counter;
@@ -32,6 +52,30 @@ extern int func_counter;
 /* Globals set on the command line */
 static int M = 0;
 static int N = 0;
+static bool use_valgrind = false; /* trace with valgrind and tracegen? */
+static int workers = 0; /* evaluations run at once, or 0 for one per CPU */
+static int huge = 0;    /* should the matrices be on huge pages? */
+static int timeout = 120; /* seconds before giving up, or 0 for never */
+static bool timing = false; /* time the functions by wall clock? */
+static int max_threads = 0; /* most threads to time on, or 0 for none */
+static bool counting = false; /* count hardware events of the functions? */
+static bool cold = false;     /* ...with A and B flushed from the caches? */
+
+/* The functions of the optimized copy of trans.c, in the order of func_list */
+static void (*timed_funcs[MAX_TRANS_FUNCS])(int M, int N, int[N][M],
+                                            int[M][N]);
+static int timed_counter = 0;
+
+/* The matrices and markers of the instrumented evaluation. They are
+   allocated and declared like those of tracegen so that they fall into
+   the same cache sets. The matrices of tracegen are local, and loading
+   their addresses makes no access that is traced. */
+volatile char MARKER_START, MARKER_END;
+static void *A;
+static void *B;
+
+/* Are the accesses of the instrumented transpose function recorded? */
+static bool recording = false;
 
 /* The correctness and performance for the submitted transpose function */
 struct results {
@@ -41,52 +85,288 @@ struct results {
 };
 static struct results results = {-1, 0, INT_MAX};
 
+/* The evaluation of a function by a worker, in memory shared with it */
+struct job {
+    bool done; /* did the worker finish? */
+    int flag;  /* 0 if correct, the exit status of tracegen otherwise */
+    int hits;
+    int misses;
+    int evictions;
+};
+
+/* A cache geometry of 2^s sets of E lines of 2^b bytes */
+struct geometry {
+    unsigned int s;
+    unsigned int E;
+    unsigned int b;
+};
+
+/* The cache geometries to compare the functions on with -G: the graded
+   cache, others of its size with more ways or other blocks, and caches the
+   size of a typical L1, L2 and last level cache. -g adds others. */
+static const struct geometry default_geometries[] = {
+    {5, 1, 5}, {4, 2, 5}, {3, 4, 5}, {6, 1, 4},   {4, 1, 6},
+    {7, 2, 5}, {6, 8, 6}, {9, 8, 6}, {11, 16, 6},
+};
+#define NUM_DEFAULT_GEOMETRIES                                                 \
+    (sizeof(default_geometries) / sizeof(default_geometries[0]))
+
+#define MAX_GEOMETRIES 32
+static struct geometry geometries[MAX_GEOMETRIES];
+static int geometry_counter = 0; /* geometries to compare, or 0 for none */
+
+/*
+ * record - Feed an access of the instrumented transpose functions to the
+ *     cache model. Only the accesses to the matrices are recorded, as the
+ *     valgrind evaluation only keeps those and not the ones to the stack.
+ */
+static void record(char type, void *addr, size_t size) {
+    char *p = addr;
+    size_t bytes = (size_t) M * N * sizeof(int);
+
+    if (recording && ((p >= (char *) A && p < (char *) A + bytes) ||
+                      (p >= (char *) B && p < (char *) B + bytes)))
+        csimAccess(type, (uintptr_t) addr, size);
+}
+
+/* trans-inst.o is trans.c compiled with -fsanitize=thread, which calls the
+   hooks below before each access it makes. They stand in for the
+   ThreadSanitizer runtime, which is not linked. */
+#define ACCESS_HOOKS(size)                                                     \
+    void __tsan_read##size(void *addr) { record('L', addr, size); }           \
+    void __tsan_write##size(void *addr) { record('S', addr, size); }          \
+    void __tsan_unaligned_read##size(void *addr) { record('L', addr, size); } \
+    void __tsan_unaligned_write##size(void *addr) { record('S', addr, size); }
+
+ACCESS_HOOKS(1)
+ACCESS_HOOKS(2)
+ACCESS_HOOKS(4)
+ACCESS_HOOKS(8)
+ACCESS_HOOKS(16)
+
+/* Accesses of other sizes, like those of AVX vectors, take these hooks */
+void __tsan_read_range(void *addr, unsigned long size) {
+    record('L', addr, size);
+}
+void __tsan_write_range(void *addr, unsigned long size) {
+    record('S', addr, size);
+}
+
+void __tsan_init(void) {}
+void __tsan_func_entry(void *pc) {}
+void __tsan_func_exit(void) {}
+
+/*
+ * registerTimedFunction - Add a function of the optimized copy of trans.c
+ *     to those to time
+ */
+void registerTimedFunction(void (*trans)(int M, int N, int[N][M], int[M][N]),
+                           char *desc) {
+    timed_funcs[timed_counter++] = trans;
+}
+
+/*
+ * registerTimedInPlaceFunction - Likewise for an in-place function, which
+ *     func_list already knows is in-place
+ */
+void registerTimedInPlaceFunction(void (*trans)(int M, int N, int[N][M],
+                                                int[M][N]),
+                                  char *desc) {
+    registerTimedFunction(trans, desc);
+}
+
+/*
+ * validate - Check that B is the transpose of A
+ */
+static int validate(int fn, int M, int N, int A[N][M], int B[M][N]) {
+    int i, j;
+
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < M; j++) {
+            if (B[j][i] != A[i][j]) {
+                printf("Validation failed on function %d! Expected %d but got "
+                       "%d at B[%d][%d]\n",
+                       fn, A[i][j], B[j][i], j, i);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * eval_instrumented - Run function i on the cache model in-process. The
+ *     accesses around the call are those tracegen makes, so the counts
+ *     are the same as under valgrind. Returns 0 if the function is
+ *     correct, and i + 1 like tracegen otherwise.
+ */
+static int eval_instrumented(int i, unsigned int s, unsigned int E,
+                             unsigned int b, int *hits, int *misses,
+                             int *evictions) {
+    initMatrix(M, N, A, B);
+    if (func_list[i].in_place)
+        prepareInPlace(M, N, A, B);
+
+    csimBegin(s, E, b);
+    csimAccess('S', (uintptr_t) &MARKER_START, 1);
+    csimAccess('L', (uintptr_t) &func_list[i].func_ptr, 8);
+    csimAccess('L', (uintptr_t) &N, 4);
+    csimAccess('L', (uintptr_t) &M, 4);
+
+    recording = true;
+    (*func_list[i].func_ptr)(M, N, A, B);
+    recording = false;
+
+    csimAccess('S', (uintptr_t) &MARKER_END, 1);
+    csimEnd(hits, misses, evictions);
+
+    return validate(i, M, N, A, B) ? 0 : i + 1;
+}
+
+/*
+ * eval_valgrind - Trace function i by running tracegen under valgrind and
+ *     simulate the trace in-process as it streams in. Returns the exit
+ *     status of tracegen.
+ */
+static int eval_valgrind(int i, unsigned int s, unsigned int E,
+                         unsigned int b, int *hits, int *misses,
+                         int *evictions) {
+    int flag, at, count = 0;
+    unsigned long long int marker_start, marker_end, low, high;
+    char cmd[255], line[512];
+    range_t ranges[MAX_RANGES];
+    bool marked = false;
+
+    /* Use valgrind to generate the trace. tracegen prints the marker
+       addresses into the trace itself, ahead of the accesses, followed by
+       the ranges of the data to simulate the accesses to. */
+    sprintf(cmd,
+            "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v "
+            "./tracegen -M %d -N %d -F %d -m -%s",
+            M, N, i, huge ? " -H" : "");
+    FILE *trace_fp = popen(cmd, "r");
+    assert(trace_fp);
+    while (!marked && fgets(line, sizeof(line), trace_fp) != NULL)
+        marked = sscanf(line, "MARKERS %llx %llx%n", &marker_start,
+                        &marker_end, &at) == 2;
+
+    if (marked) {
+        for (char *p = line + at;
+             count < MAX_RANGES && sscanf(p, " %llx-%llx%n", &low, &high,
+                                          &at) == 2;
+             p += at)
+            ranges[count++] = (range_t){low, high};
+        marked = count > 0;
+    }
+
+    /* Run the simulator on the trace of the transpose function alone.
+       It is the part of the full trace between the start and end
+       markers. Valgrind creates many spurious accesses to the stack and
+       to its own heap that have nothing to do with the students code, so
+       only the accesses to the ranges of tracegen are simulated: the
+       matrices, wherever they are mapped, and the globals the in-process
+       evaluation also accesses. The two evaluations then count the same
+       accesses. */
+    if (marked) {
+        csimBegin(s, E, b);
+        csimReplayFile(trace_fp, marker_start, marker_end, ranges, count);
+        csimEnd(hits, misses, evictions);
+    }
+
+    /* Let tracegen run to its end past the end marker */
+    while (fread(line, 1, sizeof(line), trace_fp) > 0)
+        ;
+    flag = WEXITSTATUS(pclose(trace_fp));
+    if (0 == flag && !marked)
+        flag = i + 1;
+    return flag;
+}
+
+/*
+ * run_jobs - Evaluate every registered function in a worker process of
+ *     its own, running up to `workers` of them at once. Returns the
+ *     evaluations in registration order.
+ */
+static struct job *run_jobs(unsigned int s, unsigned int E, unsigned int b) {
+    int next = 0, running = 0;
+    struct job *jobs = mmap(NULL, MAX_TRANS_FUNCS * sizeof(struct job),
+                            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                            -1, 0);
+    assert(jobs != MAP_FAILED);
+
+    if (workers == 0)
+        workers = sysconf(_SC_NPROCESSORS_ONLN) > 0
+                      ? sysconf(_SC_NPROCESSORS_ONLN)
+                      : 1;
+
+    /* The workers must not print the buffer of stdout again */
+    fflush(stdout);
+
+    while (next < func_counter || running > 0) {
+        if (next < func_counter && running < workers) {
+            pid_t pid = fork();
+            assert(pid != -1);
+
+            if (pid == 0) {
+                struct job *job = &jobs[next];
+
+                if (use_valgrind)
+                    job->flag = eval_valgrind(next, s, E, b, &job->hits,
+                                              &job->misses, &job->evictions);
+                else
+                    job->flag =
+                        eval_instrumented(next, s, E, b, &job->hits,
+                                          &job->misses, &job->evictions);
+                job->done = true;
+                fflush(stdout);
+                _exit(0);
+            }
+
+            next++;
+            running++;
+        } else if (wait(NULL) != -1) {
+            running--;
+        }
+    }
+
+    return jobs;
+}
+
 /*
  * eval_perf - Evaluate the performance of the registered transpose functions
  */
 void eval_perf(unsigned int s, unsigned int E, unsigned int b) {
-    int i, flag;
-    unsigned int len, hits, misses, evictions;
-    unsigned long long int marker_start, marker_end, addr;
-    char buf[1000], cmd[255];
-    char filename[128];
+    int i;
+    struct job *jobs;
 
     registerFunctions();
 
-    /* Open the complete trace file */
-    FILE *full_trace_fp;
-    FILE *part_trace_fp;
+    /* Evaluate the performance of all registered transpose functions at
+       once, and report them in order */
+    printf("Validating and evaluating %d functions %s (s=%d, E=%d, b=%d)\n",
+           func_counter, use_valgrind ? "with valgrind" : "in-process", s, E,
+           b);
+    jobs = run_jobs(s, E, b);
 
-    /* Evaluate the performance of each registered transpose function */
+    for (i = 0; i < func_counter; i++) {
+        /* A worker that did not finish crashed, and has reported it */
+        if (!jobs[i].done)
+            exit(1);
+    }
 
     for (i = 0; i < func_counter; i++) {
         if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0)
             results.funcid = i; /* remember which function is the submission */
 
-        printf("\nFunction %d (%d total)\nStep 1: Validating and generating "
-               "memory traces\n",
-               i, func_counter);
-        /* Use valgrind to generate the trace */
-
-        sprintf(cmd,
-                "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v "
-                "./tracegen -M %d -N %d -F %d  > trace.tmp",
-                M, N, i);
-        flag = WEXITSTATUS(system(cmd));
-        if (0 != flag) {
+        printf("\nFunction %d (%d total)\n", i, func_counter);
+        if (0 != jobs[i].flag) {
             printf("Validation error at function %d! Run ./tracegen -M %d -N "
                    "%d -F %d for details.\nSkipping performance evaluation for "
                    "this function.\n",
-                   flag - 1, M, N, i);
+                   jobs[i].flag - 1, M, N, i);
             continue;
         }
 
-        /* Get the start and end marker addresses */
-        FILE *marker_fp = fopen(".marker", "r");
-        assert(marker_fp);
-        fscanf(marker_fp, "%llx %llx", &marker_start, &marker_end);
-        fclose(marker_fp);
-
         func_list[i].correct = 1;
 
         /* Save the correctness of the transpose submission */
@@ -94,84 +374,362 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b) {
             results.correct = 1;
         }
 
-        full_trace_fp = fopen("trace.tmp", "r");
-        assert(full_trace_fp);
-
-        /* Filtered trace for each transpose function goes in a separate file */
-        sprintf(filename, "trace.f%d", i);
-        part_trace_fp = fopen(filename, "w");
-        assert(part_trace_fp);
-
-        /* Locate trace corresponding to the trans function */
-        flag = 0;
-        while (fgets(buf, 1000, full_trace_fp) != NULL) {
-
-            /* We are only interested in memory access instructions */
-            if (buf[0] == ' ' && buf[2] == ' ' &&
-                (buf[1] == 'S' || buf[1] == 'M' || buf[1] == 'L')) {
-                sscanf(buf + 3, "%llx,%u", &addr, &len);
-
-                /* If start marker found, set flag */
-                if (addr == marker_start)
-                    flag = 1;
-
-                /* Valgrind creates many spurious accesses to the
-                   stack that have nothing to do with the students
-                   code. At the moment, we are ignoring all stack
-                   accesses by using the simple filter of recording
-                   accesses to only the low 32-bit portion of the
-                   address space. At some point it would be nice to
-                   try to do more informed filtering so that would
-                   eliminate the valgrind stack references while
-                   include the student stack references. */
-                if (flag && addr < 0xffffffff) {
-                    fputs(buf, part_trace_fp);
-                }
+        func_list[i].num_hits = jobs[i].hits;
+        func_list[i].num_misses = jobs[i].misses;
+        func_list[i].num_evictions = jobs[i].evictions;
+        printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n", i,
+               func_list[i].description, jobs[i].hits, jobs[i].misses,
+               jobs[i].evictions);
+
+        /* If it is transpose_submit(), record number of misses */
+        if (results.funcid == i) {
+            results.misses = jobs[i].misses;
+        }
+    }
+
+    munmap(jobs, MAX_TRANS_FUNCS * sizeof(struct job));
+}
+
+/*
+ * register_timed - Register the functions of the timed copy of trans.c once
+ */
+static void register_timed(void) {
+    if (timed_counter > 0)
+        return;
+
+    registerTimedFunctions();
+    if (timed_counter != func_counter) {
+        printf("Error: The timed copy of trans.c registered %d functions "
+               "instead of %d\n",
+               timed_counter, func_counter);
+        exit(1);
+    }
+}
+
+/*
+ * time_function - Return the best wall clock time of a call of the
+ *     optimized copy of function i, in seconds. The calls are timed in
+ *     rounds of enough calls to take a while, and the fastest round wins.
+ */
+static double time_function(int i) {
+    struct timespec start, end;
+    double elapsed, best = 0;
+    long calls = 1, k;
+    int round;
+
+    /* An in-place function transposes B back and forth over the calls */
+    initMatrix(M, N, A, B);
+    (*timed_funcs[i])(M, N, A, B); /* warm up the caches and the TLB */
+
+    for (round = 0; round < 5; round++) {
+        do {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (k = 0; k < calls; k++)
+                (*timed_funcs[i])(M, N, A, B);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            elapsed = (end.tv_sec - start.tv_sec) +
+                      (end.tv_nsec - start.tv_nsec) / 1e9;
+
+            /* Take more calls until a round takes 10ms or more */
+        } while (elapsed < 0.01 && (calls *= 2));
+
+        if (round == 0 || elapsed / calls < best)
+            best = elapsed / calls;
+    }
+
+    /* The timed copy runs with other settings, like more threads, than the
+       evaluated one, so check it still transposes */
+    if (func_list[i].in_place) {
+        prepareInPlace(M, N, A, B);
+        (*timed_funcs[i])(M, N, A, B);
+    }
+    if (!validate(i, M, N, A, B))
+        exit(1);
+
+    return best;
+}
 
-                /* if end marker found, close trace file */
-                if (addr == marker_end) {
-                    flag = 0;
-                    fclose(part_trace_fp);
-                    break;
+/*
+ * eval_time - Time the correct functions by wall clock, next to their
+ *     simulated misses
+ */
+void eval_time(void) {
+    double seconds;
+    int i;
+
+    register_timed();
+    printf("\nWall clock time per call (best of 5 rounds)\n");
+    for (i = 0; i < func_counter; i++) {
+        if (!func_list[i].correct)
+            continue;
+
+        seconds = time_function(i);
+        printf("func %d (%s): misses:%u, time:%.3fus, bandwidth:%.2fGB/s\n", i,
+               func_list[i].description, func_list[i].num_misses,
+               seconds * 1e6, 2.0 * M * N * sizeof(int) / seconds / 1e9);
+    }
+}
+
+/*
+ * eval_scaling - Time the correct functions on 1, 2, 4 and so on up to
+ *     max_threads threads, a column of bandwidths per number of threads.
+ *     Only the parallel transposes use the threads; the others are the
+ *     baseline.
+ */
+void eval_scaling(void) {
+    int i, threads;
+
+    register_timed();
+    printf("\nBandwidth in GB/s by threads\n%-4s", "func");
+    for (threads = 1; threads < 2 * max_threads; threads *= 2)
+        printf(" %7d", threads < max_threads ? threads : max_threads);
+    printf("  description\n");
+
+    for (i = 0; i < func_counter; i++) {
+        if (!func_list[i].correct)
+            continue;
+
+        printf("%-4d", i);
+        for (threads = 1; threads < 2 * max_threads; threads *= 2) {
+            timedTransposeThreads =
+                threads < max_threads ? threads : max_threads;
+            printf(" %7.2f",
+                   2.0 * M * N * sizeof(int) / time_function(i) / 1e9);
+            fflush(stdout);
+        }
+        printf("  %s\n", func_list[i].description);
+    }
+    timedTransposeThreads = 1;
+}
+
+/* The hardware events counted with -C, as perf_event_open() types and
+   configurations, and the runs of each function to take the fewest of */
+#define CACHE_MISSES(cache)                                                    \
+    ((cache) | PERF_COUNT_HW_CACHE_OP_READ << 8 |                              \
+     PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+static const struct counter {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} counters[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"L1D-miss", PERF_TYPE_HW_CACHE, CACHE_MISSES(PERF_COUNT_HW_CACHE_L1D)},
+    {"LLC-miss", PERF_TYPE_HW_CACHE, CACHE_MISSES(PERF_COUNT_HW_CACHE_LL)},
+    {"dTLB-miss", PERF_TYPE_HW_CACHE, CACHE_MISSES(PERF_COUNT_HW_CACHE_DTLB)},
+};
+#define NUM_COUNTERS (sizeof(counters) / sizeof(counters[0]))
+#define COUNT_RUNS 5
+
+/*
+ * open_counter - Open a disabled counter of the user space events of this
+ *     thread. Returns its file descriptor, or -1 if it is unavailable.
+ */
+static int open_counter(const struct counter *counter) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter->type;
+    attr.config = counter->config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * flush_matrices - Evict every line of A and B from all of the caches
+ */
+static void flush_matrices(void) {
+    size_t bytes = (size_t) M * N * sizeof(int), k;
+
+    for (k = 0; k < bytes; k += 64) {
+        _mm_clflush((char *) A + k);
+        _mm_clflush((char *) B + k);
+    }
+    _mm_mfence();
+}
+
+/*
+ * eval_counters - Run the optimized copy of each correct function natively
+ *     and count its cycles, L1D, LLC and dTLB read misses with
+ *     perf_event_open(), next to its simulated misses. Each count is the
+ *     fewest of COUNT_RUNS runs, on data left in the caches by the run
+ *     before or flushed from them. The counts are of the calling thread
+ *     alone. Counters that are unavailable are shown as -, and the wall
+ *     clock time is shown either way.
+ */
+void eval_counters(void) {
+    int fds[NUM_COUNTERS], opened = 0, error = 0, i, run;
+    uint64_t value, best[NUM_COUNTERS];
+    struct timespec start, end;
+    double elapsed, best_time;
+    size_t k;
+
+    for (k = 0; k < NUM_COUNTERS; k++) {
+        if ((fds[k] = open_counter(&counters[k])) != -1)
+            opened++;
+        else
+            error = errno;
+    }
+
+    register_timed();
+    printf("\nHardware events per call on %s data (fewest of %d runs)\n",
+           cold ? "cold" : "warm", COUNT_RUNS);
+    if (opened == 0)
+        printf("Hardware counters are unavailable (%s), so only the wall "
+               "clock is timed\n",
+               strerror(error));
+    printf("%-4s %10s", "func", "simulated");
+    for (k = 0; k < NUM_COUNTERS; k++)
+        printf(" %12s", counters[k].name);
+    printf(" %10s  description\n", "time(us)");
+
+    for (i = 0; i < func_counter; i++) {
+        if (!func_list[i].correct)
+            continue;
+
+        for (k = 0; k < NUM_COUNTERS; k++)
+            best[k] = UINT64_MAX;
+        best_time = 0;
+
+        initMatrix(M, N, A, B);
+        (*timed_funcs[i])(M, N, A, B); /* warm up the code and the data */
+
+        for (run = 0; run < COUNT_RUNS; run++) {
+            if (func_list[i].in_place)
+                prepareInPlace(M, N, A, B);
+            if (cold)
+                flush_matrices();
+
+            for (k = 0; k < NUM_COUNTERS; k++) {
+                if (fds[k] != -1) {
+                    ioctl(fds[k], PERF_EVENT_IOC_RESET, 0);
+                    ioctl(fds[k], PERF_EVENT_IOC_ENABLE, 0);
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            (*timed_funcs[i])(M, N, A, B);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            for (k = 0; k < NUM_COUNTERS; k++) {
+                if (fds[k] != -1) {
+                    ioctl(fds[k], PERF_EVENT_IOC_DISABLE, 0);
+                    if (read(fds[k], &value, sizeof(value)) ==
+                            sizeof(value) &&
+                        value < best[k])
+                        best[k] = value;
                 }
             }
+
+            elapsed = (end.tv_sec - start.tv_sec) +
+                      (end.tv_nsec - start.tv_nsec) / 1e9;
+            if (run == 0 || elapsed < best_time)
+                best_time = elapsed;
         }
-        fclose(full_trace_fp);
-
-        /* Run the reference simulator */
-        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
-        char cmd[255];
-        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t trace.f%d > /dev/null", s,
-                E, b, i);
-        system(cmd);
-
-        /* Collect results from the reference simulator */
-        FILE *in_fp = fopen(".csim_results", "r");
-        assert(in_fp);
-        fscanf(in_fp, "%u %u %u", &hits, &misses, &evictions);
-        fclose(in_fp);
-        func_list[i].num_hits = hits;
-        func_list[i].num_misses = misses;
-        func_list[i].num_evictions = evictions;
-        printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n", i,
-               func_list[i].description, hits, misses, evictions);
 
-        /* If it is transpose_submit(), record number of misses */
-        if (results.funcid == i) {
-            results.misses = misses;
+        if (!validate(i, M, N, A, B))
+            exit(1);
+
+        printf("%-4d %10u", i, func_list[i].num_misses);
+        for (k = 0; k < NUM_COUNTERS; k++) {
+            if (best[k] == UINT64_MAX)
+                printf(" %12s", "-");
+            else
+                printf(" %12llu", (unsigned long long) best[k]);
+        }
+        printf(" %10.3f  %s\n", best_time * 1e6, func_list[i].description);
+    }
+
+    for (k = 0; k < NUM_COUNTERS; k++)
+        if (fds[k] != -1)
+            close(fds[k]);
+}
+
+/*
+ * eval_geometries - Compare the misses of the registered transpose functions
+ *     on each of the cache geometries to compare, a column per geometry
+ */
+void eval_geometries(void) {
+    static struct job *jobs[MAX_GEOMETRIES];
+    struct geometry *g;
+    char label[32];
+    int i, k;
+
+    printf("\nMisses by cache geometry (s:E:b/size)\n%-4s", "func");
+    for (k = 0; k < geometry_counter; k++) {
+        g = &geometries[k];
+        snprintf(label, sizeof(label), "%u:%u:%u/%luK", g->s, g->E, g->b,
+                 ((1ul << g->s) * g->E << g->b) >> 10);
+        printf(" %14s", label);
+        jobs[k] = run_jobs(g->s, g->E, g->b);
+    }
+    printf("  description\n");
+
+    for (i = 0; i < func_counter; i++) {
+        printf("%-4d", i);
+        for (k = 0; k < geometry_counter; k++) {
+            if (!jobs[k][i].done || jobs[k][i].flag != 0)
+                printf(" %14s", "-");
+            else
+                printf(" %14d", jobs[k][i].misses);
         }
+        printf("  %s\n", func_list[i].description);
+    }
+
+    for (k = 0; k < geometry_counter; k++)
+        munmap(jobs[k], MAX_TRANS_FUNCS * sizeof(struct job));
+}
+
+/*
+ * add_geometry - Add a cache geometry to those to compare
+ */
+static void add_geometry(struct geometry g) {
+    if (geometry_counter == MAX_GEOMETRIES) {
+        printf("Error: Too many cache geometries (at most %d)\n",
+               MAX_GEOMETRIES);
+        exit(1);
     }
+    geometries[geometry_counter++] = g;
+}
+
+/*
+ * parse_geometry - Parse a cache geometry given as s:E:b on the command line
+ */
+static struct geometry parse_geometry(const char *arg) {
+    struct geometry g;
+    char end;
+
+    if (sscanf(arg, "%u:%u:%u%c", &g.s, &g.E, &g.b, &end) != 3 || g.E == 0 ||
+        g.s + g.b > 40) {
+        printf("Error: Invalid cache geometry \"%s\", expected s:E:b\n", arg);
+        exit(1);
+    }
+    return g;
 }
 
 /*
  * usage - Print usage info
  */
 void usage(char *argv[]) {
-    printf("Usage: %s [-h] -M <rows> -N <cols>\n", argv[0]);
+    printf("Usage: %s [-hHVGT] [-g <s:E:b>] [-P <threads>] "
+           "[-C <warm|cold>] [-j <workers>] [-t <secs>] -M <rows> -N <cols>\n",
+           argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
-    printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
-    printf("  -N <cols>   Number of  matrix columns (max %d)\n", MAXN);
+    printf("  -V          Trace with valgrind instead of in-process.\n");
+    printf("  -j <n>      Evaluate n functions at once (default: CPUs)\n");
+    printf("  -H          Back the matrices with huge pages.\n");
+    printf("  -G          Also compare misses on a range of caches\n");
+    printf("  -g <s:E:b>  Also compare misses on this cache geometry\n");
+    printf("  -T          Also time the functions by wall clock\n");
+    printf("  -P <n>      Also time them on 1, 2, 4... up to n threads\n");
+    printf("  -C <data>   Also count their hardware events on warm or cold "
+           "data\n");
+    printf("  -t <secs>   Time out after secs seconds, or never if 0 "
+           "(default 120)\n");
+    printf("  -M <rows>   Number of matrix rows\n");
+    printf("  -N <cols>   Number of  matrix columns\n");
     printf("Example: %s -M 8 -N 8\n", argv[0]);
 }
 
@@ -201,7 +759,7 @@ void sigalrm_handler(int signum) {
 int main(int argc, char *argv[]) {
     char c;
 
-    while ((c = getopt(argc, argv, "M:N:h")) != -1) {
+    while ((c = getopt(argc, argv, "M:N:g:j:t:P:C:hHGTV")) != -1) {
         switch (c) {
         case 'M':
             M = atoi(optarg);
@@ -209,6 +767,41 @@ int main(int argc, char *argv[]) {
         case 'N':
             N = atoi(optarg);
             break;
+        case 'V':
+            use_valgrind = true;
+            break;
+        case 'j':
+            workers = atoi(optarg);
+            break;
+        case 'H':
+            huge = 1;
+            break;
+        case 'G':
+            for (size_t k = 0; k < NUM_DEFAULT_GEOMETRIES; k++)
+                add_geometry(default_geometries[k]);
+            break;
+        case 'g':
+            add_geometry(parse_geometry(optarg));
+            break;
+        case 'T':
+            timing = true;
+            break;
+        case 'P':
+            max_threads = atoi(optarg);
+            break;
+        case 'C':
+            counting = true;
+            if (strcmp(optarg, "cold") == 0) {
+                cold = true;
+            } else if (strcmp(optarg, "warm") != 0) {
+                printf("Error: -C takes warm or cold\n");
+                usage(argv);
+                exit(1);
+            }
+            break;
+        case 't':
+            timeout = atoi(optarg);
+            break;
         case 'h':
             usage(argv);
             exit(0);
@@ -218,14 +811,14 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (M == 0 || N == 0) {
+    if (M <= 0 || N <= 0) {
         printf("Error: Missing required argument\n");
         usage(argv);
         exit(1);
     }
 
-    if (M > MAXN || N > MAXN) {
-        printf("Error: M or N exceeds %d\n", MAXN);
+    if (workers < 0 || timeout < 0 || max_threads < 0) {
+        printf("Error: -j, -t and -P must not be negative\n");
         usage(argv);
         exit(1);
     }
@@ -242,11 +835,29 @@ int main(int argc, char *argv[]) {
     }
 
     /* Time out and give up after a while */
-    alarm(120);
+    alarm(timeout);
+
+    /* The valgrind evaluation leaves the matrices to tracegen */
+    if (!use_valgrind || timing || max_threads > 0 || counting) {
+        A = allocMatrix(M, N, huge);
+        B = allocMatrix(N, M, huge);
+    }
 
     /* Check the performance of the student's transpose function */
     eval_perf(5, 1, 5);
 
+    /* Time the functions on the machine's own caches */
+    if (timing)
+        eval_time();
+    if (max_threads > 0)
+        eval_scaling();
+    if (counting)
+        eval_counters();
+
+    /* Compare the functions on other caches than the graded one */
+    if (geometry_counter > 0)
+        eval_geometries();
+
     /* Emit the results for this particular test */
     if (results.funcid == -1) {
         printf("\nError: We could not find your transpose_submit() function\n");
@@ -0,0 +1,49 @@
+/*
+ * tracefmt.h - Binary memory trace format shared by the Cache Lab tools
+ *
+ * A binary trace is the 8-byte magic TRACE_MAGIC followed by a sequence of
+ * fixed-size trace_record_t records in host byte order. It carries the same
+ * information as the data access lines of a valgrind trace, but can be read
+ * without any parsing and be seeked by record.
+ *
+ * A run-length trace is the 8-byte magic RUN_MAGIC followed by a sequence of
+ * run_record_t records. Each record stands for `count` accesses of the same
+ * type and size whose addresses form an arithmetic progression, so that loops
+ * over arrays take a record per loop rather than per access. A record whose
+ * `lanes` is more than 1 starts a group of that many runs of the same count,
+ * itself and the records after it, which are interleaved: the accesses are
+ * the first of each run in turn, then the second of each, and so on. A loop
+ * that walks several arrays at once, such as a transpose, takes a group.
+ */
+
+#ifndef CACHELAB_TRACEFMT_H
+#define CACHELAB_TRACEFMT_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "CSIMTRC1"
+#define TRACE_MAGIC_SIZE 8
+
+typedef struct trace_record {
+    uint64_t addr; /* address of the access */
+    uint32_t size; /* size of the access in bytes */
+    char type;     /* 'L', 'S' or 'M' */
+    char pad[3];   /* padding; always zero */
+} trace_record_t;
+
+#define RUN_MAGIC "CSIMRUN1"
+
+typedef struct run_record {
+    uint64_t base;  /* address of the first access */
+    int64_t stride; /* difference between consecutive addresses */
+    uint32_t count; /* number of accesses, at least 1 */
+    uint16_t size;  /* size of each access in bytes */
+    char type;      /* 'L', 'S' or 'M' */
+    uint8_t lanes;  /* runs of the group it starts; 0 or 1 for a run of its
+                       own, and 0 in the rest of a group */
+} run_record_t;
+
+/* The most runs of a group */
+#define RUN_MAX_LANES 16
+
+#endif /* CACHELAB_TRACEFMT_H */
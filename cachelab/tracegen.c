@@ -25,21 +25,22 @@ extern void registerFunctions();
 /* Markers used to bound trace regions of interest */
 volatile char MARKER_START, MARKER_END;
 
-static int A[256][256];
-static int B[256][256];
 static int M;
 static int N;
 
+/* Print the range of the `size` bytes at `p` as " <low>-<high>" */
+static void print_range(const volatile void *p, size_t size) {
+    printf(" %llx-%llx", (unsigned long long int) p,
+           (unsigned long long int) p + size);
+}
+
 int validate(int fn, int M, int N, int A[N][M], int B[M][N]) {
-    int C[M][N];
-    memset(C, 0, sizeof(C));
-    correctTrans(M, N, A, C);
     for (int i = 0; i < M; i++) {
         for (int j = 0; j < N; j++) {
-            if (B[i][j] != C[i][j]) {
+            if (B[i][j] != A[j][i]) {
                 printf("Validation failed on function %d! Expected %d but got "
                        "%d at B[%d][%d]\n",
-                       fn, C[i][j], B[i][j], i, j);
+                       fn, A[j][i], B[i][j], i, j);
                 return 0;
             }
         }
@@ -49,10 +50,13 @@ int validate(int fn, int M, int N, int A[N][M], int B[M][N]) {
 
 int main(int argc, char *argv[]) {
     int i;
+    void *A, *B; /* the matrices, on pages of their own */
 
     char c;
     int selectedFunc = -1;
-    while ((c = getopt(argc, argv, "M:N:F:")) != -1) {
+    int huge = 0;
+    char *markerPath = ".marker";
+    while ((c = getopt(argc, argv, "M:N:F:m:H")) != -1) {
         switch (c) {
         case 'M':
             M = atoi(optarg);
@@ -63,6 +67,12 @@ int main(int argc, char *argv[]) {
         case 'F':
             selectedFunc = atoi(optarg);
             break;
+        case 'm':
+            markerPath = optarg;
+            break;
+        case 'H':
+            huge = 1;
+            break;
         case '?':
         default:
             printf("./tracegen failed to parse its options.\n");
@@ -74,18 +84,40 @@ int main(int argc, char *argv[]) {
     registerFunctions();
 
     /* Fill A with data */
+    A = allocMatrix(M, N, huge);
+    B = allocMatrix(N, M, huge);
     initMatrix(M, N, A, B);
 
-    /* Record marker addresses */
-    FILE *marker_fp = fopen(".marker", "w");
-    assert(marker_fp);
-    fprintf(marker_fp, "%llx %llx", (unsigned long long int) &MARKER_START,
-            (unsigned long long int) &MARKER_END);
-    fclose(marker_fp);
+    /* Record marker addresses. With -m -, they are printed, and flushed
+       so that they come ahead of the accesses in a trace to stdout. They
+       are followed by the ranges of the data the function is evaluated
+       on: the markers, the globals read to call the function and the
+       matrices, which may be mapped anywhere in the address space. */
+    if (strcmp(markerPath, "-") == 0) {
+        printf("MARKERS %llx %llx", (unsigned long long int) &MARKER_START,
+               (unsigned long long int) &MARKER_END);
+        print_range(&MARKER_START, 1);
+        print_range(&MARKER_END, 1);
+        print_range(&M, sizeof(M));
+        print_range(&N, sizeof(N));
+        print_range(func_list, sizeof(func_list));
+        print_range(A, (size_t) M * N * sizeof(int));
+        print_range(B, (size_t) M * N * sizeof(int));
+        printf("\n");
+        fflush(stdout);
+    } else {
+        FILE *marker_fp = fopen(markerPath, "w");
+        assert(marker_fp);
+        fprintf(marker_fp, "%llx %llx", (unsigned long long int) &MARKER_START,
+                (unsigned long long int) &MARKER_END);
+        fclose(marker_fp);
+    }
 
     if (-1 == selectedFunc) {
         /* Invoke registered transpose functions */
         for (i = 0; i < func_counter; i++) {
+            if (func_list[i].in_place)
+                prepareInPlace(M, N, A, B);
             MARKER_START = 33;
             (*func_list[i].func_ptr)(M, N, A, B);
             MARKER_END = 34;
@@ -93,6 +125,8 @@ int main(int argc, char *argv[]) {
                 return i + 1;
         }
     } else {
+        if (func_list[selectedFunc].in_place)
+            prepareInPlace(M, N, A, B);
         MARKER_START = 33;
         (*func_list[selectedFunc].func_ptr)(M, N, A, B);
         MARKER_END = 34;
@@ -0,0 +1,348 @@
+/*
+ * tracepack.c - Compresses memory traces into run-length traces, and expands
+ *     them back.
+ *
+ * The input is a valgrind or binary trace, and the output is a run-length
+ * trace of tracefmt.h, whose records are runs of accesses of the same type
+ * and size at constant stride, alone or interleaved in groups. The groups are
+ * found greedily: the accesses not yet in a group start one as soon as the
+ * first three rounds of some number of interleaved runs, the fewest that fit,
+ * can be seen at their front. Each access then extends the next run of the
+ * group in turn, until one does not continue its progression. With -d, a
+ * run-length trace is expanded into a valgrind or binary trace instead, which
+ * holds exactly the data accesses that were compressed.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefmt.h"
+
+static const char usage[] =
+    "Usage: %s [-hd] [-f <format>] [-o <file>] <tracefile>\n"
+    "Options:\n"
+    "   -h             Display this usage info and quit.\n"
+    "   -d             Expand a run-length trace instead of compressing.\n"
+    "   -f <format>    Format of the expanded trace, text or binary (default\n"
+    "                  text).\n"
+    "   -o <file>      Output file (default stdout).\n";
+
+static FILE *infile = NULL;  // The trace to read.
+static FILE *outfile = NULL; // The file to write the output into.
+static bool binary = false;  // Is the input, or the expanded output, binary?
+
+/* The accesses read but not yet in a group, enough to find the first three
+   rounds of the largest group */
+#define PENDING_MAX (3 * RUN_MAX_LANES)
+
+static run_record_t group[RUN_MAX_LANES]; // The runs of the group being built.
+static size_t lanes = 0;     // The number of runs of the group, or 0 if none.
+static size_t lane = 0;      // The run the next access of the group extends.
+static trace_record_t pending[PENDING_MAX]; // The accesses not in a group.
+static size_t pendingCount = 0; // The number of accesses in `pending`.
+static uint64_t accesses = 0; // The number of accesses read.
+static uint64_t runs = 0;     // The number of run records written.
+
+static void openInput(char path[], bool expand);
+static bool readAccess(trace_record_t *dst);
+static void extendRun(trace_record_t *access);
+static void closeGroup();
+static void startGroup();
+static void writeGroup(size_t count);
+static void expandRuns();
+static void writeAccess(char type, uint64_t addr, uint32_t size);
+
+int main(int argc, char *argv[]) {
+    int ch;
+    bool expand = false;
+    char *format = "text";
+    trace_record_t access;
+
+    outfile = stdout;
+
+    while ((ch = getopt(argc, argv, "hdf:o:")) != -1) {
+        switch (ch) {
+        case 'h':
+            printf(usage, argv[0]);
+            exit(0);
+        case 'd':
+            expand = true;
+            break;
+        case 'f':
+            format = optarg;
+            break;
+        case 'o':
+            if ((outfile = fopen(optarg, "wb")) == NULL) {
+                printf("Error: failed to open file %s\n", optarg);
+                exit(-1);
+            }
+
+            break;
+        default:
+            printf(usage, argv[0]);
+            exit(-1);
+        }
+    }
+
+    if (optind + 1 != argc) {
+        printf("Error: missing required argument\n");
+        printf(usage, argv[0]);
+        exit(-1);
+    }
+
+    if (strcmp(format, "text") != 0 && strcmp(format, "binary") != 0) {
+        printf("Error: unknown format %s\n", format);
+        exit(-1);
+    }
+
+    openInput(argv[optind], expand);
+
+    if (expand) {
+        binary = strcmp(format, "binary") == 0;
+        expandRuns();
+    } else {
+        if (fwrite(RUN_MAGIC, 1, TRACE_MAGIC_SIZE, outfile) !=
+            TRACE_MAGIC_SIZE) {
+            printf("Error: failed to write the trace\n");
+            exit(-1);
+        }
+
+        while (readAccess(&access))
+            extendRun(&access);
+
+        /* Write out what is left, which may still start groups */
+        do {
+            closeGroup();
+            if (pendingCount > 0)
+                startGroup();
+        } while (lanes > 0 || pendingCount > 0);
+    }
+
+    if (fclose(infile) == EOF || fclose(outfile) == EOF) {
+        printf("Error: failed to close the file\n");
+        exit(-1);
+    }
+
+    /* The summary would corrupt a trace written to stdout. */
+    if (!expand && outfile != stdout)
+        printf("accesses:%" PRIu64 " runs:%" PRIu64 " ratio:%.1f\n", accesses,
+               runs, runs > 0 ? (double) accesses / runs : 0);
+
+    return 0;
+}
+
+/* Open the trace `path` and find out its format from its magic, which is
+ * consumed. A run-length trace is required if `expand` is set, and refused
+ * otherwise. Exits the program on failure. */
+static void openInput(char path[], bool expand) {
+    char magic[TRACE_MAGIC_SIZE];
+
+    if ((infile = fopen(path, "rb")) == NULL) {
+        printf("Error: failed to open file %s\n", path);
+        exit(-1);
+    }
+
+    bool read = fread(magic, 1, TRACE_MAGIC_SIZE, infile) == TRACE_MAGIC_SIZE;
+    bool runLength = read && memcmp(magic, RUN_MAGIC, TRACE_MAGIC_SIZE) == 0;
+
+    if (runLength != expand) {
+        printf("Error: %s %s a run-length trace\n", path,
+               expand ? "is not" : "is already");
+        exit(-1);
+    }
+
+    binary = read && memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0;
+
+    if (!binary && !runLength)
+        rewind(infile);
+}
+
+/* Read the next access of the input into `dst`, skipping the lines of a
+ * valgrind trace that are not data accesses. Returns false at the end of the
+ * trace. Exits the program if the trace is ill-formed. */
+static bool readAccess(trace_record_t *dst) {
+    char input[64];
+
+    if (binary) {
+        if (fread(dst, sizeof(trace_record_t), 1, infile) != 1)
+            return false;
+    } else {
+        do {
+            if (fgets(input, sizeof(input), infile) == NULL)
+                return false;
+        } while (input[0] != ' ');
+
+        if (sscanf(input, " %c %" SCNx64 ",%" SCNu32, &dst->type, &dst->addr,
+                   &dst->size) < 3)
+            dst->type = '\0';
+    }
+
+    if ((dst->type != 'L' && dst->type != 'S' && dst->type != 'M') ||
+        dst->size > UINT16_MAX) {
+        printf("Error: parsing failed\n");
+        exit(-1);
+    }
+
+    accesses++;
+    return true;
+}
+
+/* Add `access` to the next run of the current group if it continues it. Or
+ * else close the group, and add `access` to the pending accesses, starting
+ * groups from them while they can. */
+static void extendRun(trace_record_t *access) {
+    run_record_t *run = &group[lane];
+
+    if (lanes > 0 && run->count < UINT32_MAX && access->type == run->type &&
+        access->size == run->size &&
+        access->addr == run->base + run->count * (uint64_t) run->stride) {
+        run->count++;
+        lane = (lane + 1) % lanes;
+        return;
+    }
+
+    closeGroup();
+    pending[pendingCount++] = *access;
+    startGroup();
+}
+
+/* Write out the whole rounds of the current group, if any, and put the
+ * accesses of the last round, if it is not whole, back in front of the
+ * pending ones. */
+static void closeGroup() {
+    if (lanes == 0)
+        return;
+
+    size_t rounds = group[lanes - 1].count;
+
+    memmove(pending + lane, pending, pendingCount * sizeof(trace_record_t));
+    for (size_t i = 0; i < lane; i++)
+        pending[i] = (trace_record_t){
+            .addr = group[i].base + rounds * (uint64_t) group[i].stride,
+            .size = group[i].size,
+            .type = group[i].type};
+    pendingCount += lane;
+
+    writeGroup(rounds);
+    lanes = lane = 0;
+}
+
+/* Start a group of the fewest runs whose first three rounds are at the front
+ * of the pending accesses, and extend it with the rest of them. If there is
+ * none, and there never will be as the pending accesses are full or the trace
+ * ended, write out the first pending access as a run of its own. */
+static void startGroup() {
+    trace_record_t *p = pending;
+    size_t n;
+
+    for (n = 1; n <= RUN_MAX_LANES && 3 * n <= pendingCount; n++) {
+        size_t i;
+
+        for (i = n; i < 3 * n; i++)
+            if (p[i].type != p[i - n].type || p[i].size != p[i - n].size ||
+                (i >= 2 * n && p[i].addr - p[i - n].addr !=
+                                   p[i - n].addr - p[i - 2 * n].addr))
+                break;
+
+        if (i == 3 * n)
+            break;
+    }
+
+    if (n <= RUN_MAX_LANES && 3 * n <= pendingCount) {
+        trace_record_t rest[PENDING_MAX];
+        size_t restCount = pendingCount - 3 * n;
+
+        for (size_t i = 0; i < n; i++)
+            group[i] = (run_record_t){.base = p[i].addr,
+                                      .stride = (int64_t) (p[i + n].addr -
+                                                           p[i].addr),
+                                      .count = 3,
+                                      .size = p[i].size,
+                                      .type = p[i].type};
+        lanes = n;
+        lane = 0;
+
+        /* The rest may continue the group, or close it and start another */
+        memcpy(rest, p + 3 * n, restCount * sizeof(trace_record_t));
+        pendingCount = 0;
+        for (size_t i = 0; i < restCount; i++)
+            extendRun(&rest[i]);
+        return;
+    }
+
+    if (pendingCount == PENDING_MAX || feof(infile)) {
+        group[0] = (run_record_t){.base = p[0].addr,
+                                  .count = 1,
+                                  .size = p[0].size,
+                                  .type = p[0].type};
+        lanes = 1;
+        writeGroup(1);
+        lanes = 0;
+        memmove(p, p + 1, --pendingCount * sizeof(trace_record_t));
+    }
+}
+
+/* Write out the runs of the current group with `count` accesses each. */
+static void writeGroup(size_t count) {
+    for (size_t i = 0; i < lanes; i++) {
+        group[i].count = count;
+        group[i].lanes = i == 0 && lanes > 1 ? lanes : 0;
+    }
+
+    if (fwrite(group, sizeof(run_record_t), lanes, outfile) != lanes) {
+        printf("Error: failed to write the trace\n");
+        exit(-1);
+    }
+
+    runs += lanes;
+}
+
+/* Expand each run of the input into its accesses. */
+static void expandRuns() {
+    if (binary && fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, outfile) !=
+                      TRACE_MAGIC_SIZE) {
+        printf("Error: failed to write the trace\n");
+        exit(-1);
+    }
+
+    while (fread(&group[0], sizeof(run_record_t), 1, infile) == 1) {
+        lanes = group[0].lanes > 1 ? group[0].lanes : 1;
+
+        if (lanes > RUN_MAX_LANES ||
+            fread(group + 1, sizeof(run_record_t), lanes - 1, infile) !=
+                lanes - 1) {
+            printf("Error: parsing failed\n");
+            exit(-1);
+        }
+
+        for (uint64_t i = 0; i < group[0].count; i++)
+            for (size_t j = 0; j < lanes; j++)
+                writeAccess(group[j].type,
+                            group[j].base + i * (uint64_t) group[j].stride,
+                            group[j].size);
+    }
+}
+
+/* Write an access to the expanded trace. */
+static void writeAccess(char type, uint64_t addr, uint32_t size) {
+    int written;
+
+    if (binary) {
+        trace_record_t record = {.addr = addr, .size = size, .type = type};
+        written = fwrite(&record, sizeof(record), 1, outfile) == 1;
+    } else {
+        written = fprintf(outfile, " %c %" PRIx64 ",%" PRIu32 "\n", type, addr,
+                          size) > 0;
+    }
+
+    if (!written) {
+        printf("Error: failed to write the trace\n");
+        exit(-1);
+    }
+}
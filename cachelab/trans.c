@@ -7,13 +7,20 @@
  * A transpose function is evaluated by counting the number of misses
  * on a 1KB direct mapped cache with a block size of 32 bytes.
  */
+#define _GNU_SOURCE
+
 #include "cachelab.h"
+#include <immintrin.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 int is_transpose(int M, int N, int A[N][M], int B[M][N]);
 
 void transpose_32(int M, int N, int A[N][M], int B[M][N]) {
-    int ib, jb, i, j, temp;
+    int ib, jb, i, j, temp = 0;
 
     for (ib = 0; ib < N; ib += 8) {
         for (jb = 0; jb < M; jb += 8) {
@@ -25,7 +32,7 @@ void transpose_32(int M, int N, int A[N][M], int B[M][N]) {
                         B[j][i] = A[i][j];
                 }
 
-                if (ib == jb)
+                if (ib == jb && i < M)
                     B[i][i] = temp;
             }
         }
@@ -113,7 +120,7 @@ void transpose_64(int M, int N, int A[N][M], int B[M][N]) {
 }
 
 void transpose_61(int M, int N, int A[N][M], int B[M][N]) {
-    int ib, jb, i, j, temp;
+    int ib, jb, i, j, temp = 0;
 
     for (ib = 0; ib < N; ib += 16) {
         for (jb = 0; jb < M; jb += 16) {
@@ -125,7 +132,7 @@ void transpose_61(int M, int N, int A[N][M], int B[M][N]) {
                         B[j][i] = A[i][j];
                 }
 
-                if (ib == jb)
+                if (ib == jb && i < M)
                     B[i][i] = temp;
             }
         }
@@ -169,6 +176,522 @@ void trans(int M, int N, int A[N][M], int B[M][N]) {
     }
 }
 
+/*
+ * The cache-oblivious transposes below assume nothing about the cache. The
+ * recursive one halves the longer side of the matrix until the pieces are
+ * register tiles, so that at some depth the pieces fit in each level of
+ * any cache hierarchy. The Morton one walks the register tiles in Z-order,
+ * which visits them in the same nested squares without recursing. Unlike
+ * the submission, they recurse and call helpers, so they are for
+ * comparison only.
+ */
+#define CO_TILE 4
+
+/*
+ * transpose_tile - Transpose the register tile of rows i0..i1 and columns
+ *     j0..j1 of A, at most CO_TILE on a side, a row of A at a time.
+ */
+static void transpose_tile(int M, int N, int A[N][M], int B[M][N], int i0,
+                           int i1, int j0, int j1) {
+    int i, j, t0, t1, t2, t3;
+
+    if (j1 - j0 == CO_TILE) {
+        for (i = i0; i < i1; i++) {
+            t0 = A[i][j0];
+            t1 = A[i][j0 + 1];
+            t2 = A[i][j0 + 2];
+            t3 = A[i][j0 + 3];
+            B[j0][i] = t0;
+            B[j0 + 1][i] = t1;
+            B[j0 + 2][i] = t2;
+            B[j0 + 3][i] = t3;
+        }
+    } else {
+        for (i = i0; i < i1; i++)
+            for (j = j0; j < j1; j++)
+                B[j][i] = A[i][j];
+    }
+}
+
+/*
+ * transpose_split - Transpose rows i0..i1 and columns j0..j1 of A by
+ *     halving the longer side until the pieces are register tiles
+ */
+static void transpose_split(int M, int N, int A[N][M], int B[M][N], int i0,
+                            int i1, int j0, int j1) {
+    if (i1 - i0 <= CO_TILE && j1 - j0 <= CO_TILE) {
+        transpose_tile(M, N, A, B, i0, i1, j0, j1);
+    } else if (i1 - i0 >= j1 - j0) {
+        transpose_split(M, N, A, B, i0, (i0 + i1) / 2, j0, j1);
+        transpose_split(M, N, A, B, (i0 + i1) / 2, i1, j0, j1);
+    } else {
+        transpose_split(M, N, A, B, i0, i1, j0, (j0 + j1) / 2);
+        transpose_split(M, N, A, B, i0, i1, (j0 + j1) / 2, j1);
+    }
+}
+
+/*
+ * transpose_recursive - Cache-oblivious divide-and-conquer transpose
+ */
+char transpose_recursive_desc[] = "Cache-oblivious recursive transpose";
+void transpose_recursive(int M, int N, int A[N][M], int B[M][N]) {
+    transpose_split(M, N, A, B, 0, N, 0, M);
+}
+
+/*
+ * transpose_morton - Cache-oblivious transpose of the register tiles in
+ *     Z-order. The k-th tile of the order has the even bits of k as its
+ *     tile column and the odd bits as its tile row; the tiles of the
+ *     enclosing power-of-two square that miss the matrix are skipped.
+ */
+char transpose_morton_desc[] = "Cache-oblivious Morton-order transpose";
+void transpose_morton(int M, int N, int A[N][M], int B[M][N]) {
+    int rows = (N + CO_TILE - 1) / CO_TILE, cols = (M + CO_TILE - 1) / CO_TILE;
+    int side = 1, k, bit, ti, tj;
+
+    while (side < rows || side < cols)
+        side *= 2;
+
+    for (k = 0; k < side * side; k++) {
+        ti = tj = 0;
+        for (bit = 0; (1 << bit) < side; bit++) {
+            tj |= ((k >> (2 * bit)) & 1) << bit;
+            ti |= ((k >> (2 * bit + 1)) & 1) << bit;
+        }
+
+        if (ti < rows && tj < cols)
+            transpose_tile(M, N, A, B, ti * CO_TILE,
+                           ti * CO_TILE + CO_TILE < N ? ti * CO_TILE + CO_TILE
+                                                      : N,
+                           tj * CO_TILE,
+                           tj * CO_TILE + CO_TILE < M ? tj * CO_TILE + CO_TILE
+                                                      : M);
+    }
+}
+
+/*
+ * The SIMD transposes below keep a whole tile in vector registers: the rows
+ * of the tile are loaded, transposed with unpacks and shuffles, and stored
+ * as the columns. The SSE2 one moves 4x4 tiles and the AVX2 one 8x8 tiles.
+ * The rows and columns beyond the last whole tile are moved a word at a
+ * time. transpose_simd picks the widest kernel the CPU runs.
+ */
+
+/*
+ * transpose_edges - Transpose the rows from i0 and the columns from j0 of
+ *     A, which the whole tiles of a SIMD transpose leave over
+ */
+static void transpose_edges(int M, int N, int A[N][M], int B[M][N], int i0,
+                            int j0) {
+    int i, j;
+
+    for (i = 0; i < N; i++)
+        for (j = (i < i0 ? j0 : 0); j < M; j++)
+            B[j][i] = A[i][j];
+}
+
+/*
+ * transpose_sse2 - Transpose in 4x4 tiles of SSE2 registers
+ */
+char transpose_sse2_desc[] = "SIMD 4x4 tile transpose (SSE2)";
+__attribute__((target("sse2"))) void transpose_sse2(int M, int N,
+                                                    int A[N][M], int B[M][N]) {
+    int i, j;
+    __m128i r0, r1, r2, r3, t0, t1, t2, t3;
+
+    for (i = 0; i + 4 <= N; i += 4) {
+        for (j = 0; j + 4 <= M; j += 4) {
+            r0 = _mm_loadu_si128((__m128i *) &A[i][j]);
+            r1 = _mm_loadu_si128((__m128i *) &A[i + 1][j]);
+            r2 = _mm_loadu_si128((__m128i *) &A[i + 2][j]);
+            r3 = _mm_loadu_si128((__m128i *) &A[i + 3][j]);
+
+            t0 = _mm_unpacklo_epi32(r0, r1); /* a0 b0 a1 b1 */
+            t1 = _mm_unpacklo_epi32(r2, r3); /* c0 d0 c1 d1 */
+            t2 = _mm_unpackhi_epi32(r0, r1); /* a2 b2 a3 b3 */
+            t3 = _mm_unpackhi_epi32(r2, r3); /* c2 d2 c3 d3 */
+
+            _mm_storeu_si128((__m128i *) &B[j][i], _mm_unpacklo_epi64(t0, t1));
+            _mm_storeu_si128((__m128i *) &B[j + 1][i],
+                             _mm_unpackhi_epi64(t0, t1));
+            _mm_storeu_si128((__m128i *) &B[j + 2][i],
+                             _mm_unpacklo_epi64(t2, t3));
+            _mm_storeu_si128((__m128i *) &B[j + 3][i],
+                             _mm_unpackhi_epi64(t2, t3));
+        }
+    }
+
+    transpose_edges(M, N, A, B, N - N % 4, M - M % 4);
+}
+
+/*
+ * transpose_avx2 - Transpose in 8x8 tiles of AVX2 registers
+ */
+char transpose_avx2_desc[] = "SIMD 8x8 tile transpose (AVX2)";
+__attribute__((target("avx2"))) void transpose_avx2(int M, int N,
+                                                    int A[N][M], int B[M][N]) {
+    int i, j, k;
+    __m256i r[8], t[8], u[8];
+
+    for (i = 0; i + 8 <= N; i += 8) {
+        for (j = 0; j + 8 <= M; j += 8) {
+            for (k = 0; k < 8; k++)
+                r[k] = _mm256_loadu_si256((__m256i *) &A[i + k][j]);
+
+            /* Interleave the words of row pairs, then the pairs of words of
+               those, which transposes the 4x4 quarters in each lane */
+            for (k = 0; k < 8; k += 2) {
+                t[k] = _mm256_unpacklo_epi32(r[k], r[k + 1]);
+                t[k + 1] = _mm256_unpackhi_epi32(r[k], r[k + 1]);
+            }
+            for (k = 0; k < 8; k += 4) {
+                u[k] = _mm256_unpacklo_epi64(t[k], t[k + 2]);
+                u[k + 1] = _mm256_unpackhi_epi64(t[k], t[k + 2]);
+                u[k + 2] = _mm256_unpacklo_epi64(t[k + 1], t[k + 3]);
+                u[k + 3] = _mm256_unpackhi_epi64(t[k + 1], t[k + 3]);
+            }
+
+            /* Swap the off-diagonal quarters across the lanes */
+            for (k = 0; k < 4; k++) {
+                _mm256_storeu_si256((__m256i *) &B[j + k][i],
+                                    _mm256_permute2x128_si256(u[k], u[k + 4],
+                                                              0x20));
+                _mm256_storeu_si256((__m256i *) &B[j + k + 4][i],
+                                    _mm256_permute2x128_si256(u[k], u[k + 4],
+                                                              0x31));
+            }
+        }
+    }
+
+    transpose_edges(M, N, A, B, N - N % 8, M - M % 8);
+}
+
+/*
+ * transpose_simd - Transpose with the widest SIMD kernel the CPU supports
+ */
+char transpose_simd_desc[] = "SIMD tile transpose (widest supported)";
+void transpose_simd(int M, int N, int A[N][M], int B[M][N]) {
+    if (__builtin_cpu_supports("avx2"))
+        transpose_avx2(M, N, A, B);
+    else
+        transpose_sse2(M, N, A, B);
+}
+
+/*
+ * The parallel transposes below split A into bands of whole columns, which
+ * are whole rows of B, and the bands into tiles of TILE_ROWS rows. A band
+ * is a multiple of rows of B that starts on a cache line, so no two threads
+ * ever write the same line of B. The static one gives each thread a run of
+ * neighbouring bands, and the pool pins each worker to its own CPU; on a
+ * NUMA machine the CPUs of a node are numbered together, so the runs of
+ * neighbouring threads stay on one node. The
+ * stealing one starts from the same runs, but a thread that runs out takes
+ * bands from the end of another's run. The harness sets transpose_threads;
+ * with one thread, the transposes run on the calling thread.
+ */
+#define MAX_THREADS 256
+#define LINE_BYTES 64
+#define TILE_ROWS 8
+
+int transpose_threads = 1;
+
+/* The bands left to a thread, taken from the front by the thread itself
+   and from the back by thieves */
+struct band_run {
+    pthread_mutex_t lock;
+    int next;
+    int end;
+};
+
+/* A parallel transpose in progress */
+struct parallel_job {
+    int M;
+    int N;
+    void *A;
+    void *B;
+    int width;   /* columns of A in a band */
+    int threads; /* threads taking part */
+    int steal;   /* may a thread take the bands of others? */
+    struct band_run runs[MAX_THREADS];
+};
+
+/* The pool of worker threads, which start a job when the generation goes
+   up and count down pending as they finish it. Thread 0 is the caller. */
+static pthread_t pool[MAX_THREADS];
+static int pool_size = 1;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static unsigned long pool_generation = 0;
+static int pool_pending = 0;
+static struct parallel_job *pool_job = NULL;
+
+/*
+ * transpose_band - Transpose the columns of band k of A, a tile of
+ *     TILE_ROWS rows at a time
+ */
+static void transpose_band(struct parallel_job *job, int k) {
+    int M = job->M, N = job->N;
+    int(*A)[M] = job->A;
+    int(*B)[N] = job->B;
+    int i0, i, j, j0 = k * job->width;
+    int j1 = j0 + job->width < M ? j0 + job->width : M;
+
+    for (i0 = 0; i0 < N; i0 += TILE_ROWS)
+        for (i = i0; i < i0 + TILE_ROWS && i < N; i++)
+            for (j = j0; j < j1; j++)
+                B[j][i] = A[i][j];
+}
+
+/*
+ * take_band - Take a band from the front of a run if the taker owns it,
+ *     and from the back otherwise. Returns -1 if the run is empty.
+ */
+static int take_band(struct band_run *run, int own) {
+    int k = -1;
+
+    pthread_mutex_lock(&run->lock);
+    if (run->next < run->end)
+        k = own ? run->next++ : --run->end;
+    pthread_mutex_unlock(&run->lock);
+    return k;
+}
+
+/*
+ * run_bands - Do the part of a parallel transpose of thread id
+ */
+static void run_bands(struct parallel_job *job, int id) {
+    struct band_run *run = &job->runs[id];
+    int k, victim;
+
+    if (!job->steal) {
+        for (k = run->next; k < run->end; k++)
+            transpose_band(job, k);
+        return;
+    }
+
+    while ((k = take_band(run, 1)) >= 0)
+        transpose_band(job, k);
+
+    /* Steal from the others in turn until all of them run out */
+    for (victim = (id + 1) % job->threads; victim != id;
+         victim = (victim + 1) % job->threads)
+        while ((k = take_band(&job->runs[victim], 0)) >= 0)
+            transpose_band(job, k);
+}
+
+/*
+ * pool_worker - Run the part of thread id of each job of the pool
+ */
+static void *pool_worker(void *arg) {
+    int id = (int) (long) arg;
+    unsigned long seen = 0;
+    struct parallel_job *job;
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    for (;;) {
+        pthread_mutex_lock(&pool_lock);
+        while (pool_generation == seen)
+            pthread_cond_wait(&pool_start, &pool_lock);
+        seen = pool_generation;
+        job = pool_job;
+        pthread_mutex_unlock(&pool_lock);
+
+        if (id < job->threads)
+            run_bands(job, id);
+
+        pthread_mutex_lock(&pool_lock);
+        if (--pool_pending == 0)
+            pthread_cond_signal(&pool_done);
+        pthread_mutex_unlock(&pool_lock);
+    }
+    return NULL;
+}
+
+/*
+ * transpose_parallel - Transpose with transpose_threads threads, stealing
+ *     bands if steal is set
+ */
+static void transpose_parallel(int M, int N, int A[N][M], int B[M][N],
+                               int steal) {
+    static struct parallel_job job;
+    static int initialized = 0;
+    int threads = transpose_threads, words = LINE_BYTES / sizeof(int);
+    int bands, id, common;
+
+    if (!initialized) {
+        for (id = 0; id < MAX_THREADS; id++)
+            pthread_mutex_init(&job.runs[id].lock, NULL);
+        initialized = 1;
+    }
+
+    /* A row of B starts on a line every words / gcd(N, words) rows */
+    for (common = words; N % common != 0; common /= 2)
+        ;
+
+    job.M = M;
+    job.N = N;
+    job.A = A;
+    job.B = B;
+    job.width = words / common > TILE_ROWS ? words / common : TILE_ROWS;
+    job.steal = steal;
+    bands = (M + job.width - 1) / job.width;
+
+    threads = threads < 1 ? 1 : threads > MAX_THREADS ? MAX_THREADS : threads;
+    threads = threads < bands ? threads : bands;
+
+    /* Grow the pool to the threads of the job. If a thread fails to start,
+       the job makes do with the threads the pool has. */
+    for (; pool_size < threads; pool_size++)
+        if (pthread_create(&pool[pool_size], NULL, pool_worker,
+                           (void *) (long) pool_size) != 0)
+            break;
+
+    job.threads = threads < pool_size ? threads : pool_size;
+    for (id = 0; id < job.threads; id++) {
+        job.runs[id].next = (long) bands * id / job.threads;
+        job.runs[id].end = (long) bands * (id + 1) / job.threads;
+    }
+
+    if (job.threads == 1) {
+        run_bands(&job, 0);
+        return;
+    }
+
+    /* Start the pool */
+
+    pthread_mutex_lock(&pool_lock);
+    pool_job = &job;
+    pool_pending = pool_size - 1;
+    pool_generation++;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_lock);
+
+    run_bands(&job, 0);
+
+    pthread_mutex_lock(&pool_lock);
+    while (pool_pending > 0)
+        pthread_cond_wait(&pool_done, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * transpose_static - Parallel transpose of static runs of bands
+ */
+char transpose_static_desc[] = "Parallel band transpose (static)";
+void transpose_static(int M, int N, int A[N][M], int B[M][N]) {
+    transpose_parallel(M, N, A, B, 0);
+}
+
+/*
+ * transpose_stealing - Parallel transpose of bands with work stealing
+ */
+char transpose_stealing_desc[] = "Parallel band transpose (work stealing)";
+void transpose_stealing(int M, int N, int A[N][M], int B[M][N]) {
+    transpose_parallel(M, N, A, B, 1);
+}
+
+/*
+ * The in-place transposes below need no second matrix. They are registered
+ * with registerInPlaceFunction(), and find A copied into B, which they
+ * transpose where it is; A is left alone. The square one swaps the tiles
+ * above the diagonal with their mirror images below it. The rectangular
+ * one follows the cycles of the permutation that moves the element at
+ * offset k of the N x M matrix to offset k * N mod (M * N - 1) of the
+ * M x N one, with a bit per element to mark those already moved. The
+ * bit vector is on the heap, and its accesses are left out of the miss
+ * counts like any other access outside A and B: the in-process and the
+ * valgrind evaluation both simulate the accesses to the matrices only.
+ */
+#define IP_TILE 8
+
+/*
+ * cycle_leader - Return whether start is the least offset of its cycle of
+ *     the permutation of transpose_cycles
+ */
+static int cycle_leader(long start, int N, long size) {
+    long k = start;
+
+    do {
+        k = k * N % (size - 1);
+        if (k < start)
+            return 0;
+    } while (k != start);
+    return 1;
+}
+
+/*
+ * transpose_cycles - In-place transpose of any shape by cycle-following.
+ *     If the bit vector can't be allocated, each cycle is followed from
+ *     its least offset instead, which is found by walking the cycle.
+ */
+char transpose_cycles_desc[] = "In-place cycle-following transpose";
+void transpose_cycles(int M, int N, int A[N][M], int B[M][N]) {
+    int *X = &B[0][0];
+    long size = (long) M * N, start, k;
+    unsigned char *moved;
+    int carried, temp;
+
+    /* The first and last elements stay where they are */
+    if (size < 3)
+        return;
+    moved = calloc((size + 7) / 8, 1);
+
+    for (start = 1; start < size - 1; start++) {
+        if (moved != NULL ? moved[start / 8] & (1 << start % 8)
+                          : !cycle_leader(start, N, size))
+            continue;
+
+        /* Carry each element of the cycle to where the one before was */
+        carried = X[start];
+        k = start;
+        do {
+            k = k * N % (size - 1);
+            temp = X[k];
+            X[k] = carried;
+            carried = temp;
+            if (moved != NULL)
+                moved[k / 8] |= 1 << k % 8;
+        } while (k != start);
+    }
+
+    free(moved);
+}
+
+/*
+ * transpose_swap - In-place transpose of a square matrix by swapping
+ *     IP_TILE x IP_TILE tiles across the diagonal. Other shapes fall back
+ *     to transpose_cycles, so its results are those of transpose_cycles.
+ */
+char transpose_swap_desc[] =
+    "In-place tile swap transpose (square, else cycle-following)";
+void transpose_swap(int M, int N, int A[N][M], int B[M][N]) {
+    int ib, jb, i, j, temp;
+
+    if (M != N) {
+        transpose_cycles(M, N, A, B);
+        return;
+    }
+
+    for (ib = 0; ib < N; ib += IP_TILE) {
+        for (jb = ib; jb < N; jb += IP_TILE) {
+            /* A tile on the diagonal swaps with itself, across it */
+            for (i = ib; i < ib + IP_TILE && i < N; i++) {
+                for (j = (ib == jb ? i + 1 : jb); j < jb + IP_TILE && j < N;
+                     j++) {
+                    temp = B[i][j];
+                    B[i][j] = B[j][i];
+                    B[j][i] = temp;
+                }
+            }
+        }
+    }
+}
+
 /*
  * registerFunctions - This function registers your transpose
  *     functions with the driver.  At runtime, the driver will
@@ -182,6 +705,15 @@ void registerFunctions() {
 
     /* Register any additional transpose functions */
     registerTransFunction(trans, trans_desc);
+    registerTransFunction(transpose_recursive, transpose_recursive_desc);
+    registerTransFunction(transpose_morton, transpose_morton_desc);
+    registerTransFunction(transpose_simd, transpose_simd_desc);
+    if (__builtin_cpu_supports("avx2"))
+        registerTransFunction(transpose_sse2, transpose_sse2_desc);
+    registerTransFunction(transpose_static, transpose_static_desc);
+    registerTransFunction(transpose_stealing, transpose_stealing_desc);
+    registerInPlaceFunction(transpose_swap, transpose_swap_desc);
+    registerInPlaceFunction(transpose_cycles, transpose_cycles_desc);
 }
 
 /*
@@ -0,0 +1,612 @@
+/*
+ * transtune.c - Searches a space of tiled transpose kernels for the one with
+ *     the fewest misses on a cache, and writes it out as C code.
+ *
+ * A candidate kernel walks the tiles of A in row or column order, and each
+ * tile row by row or column by column. The elements on the diagonal are
+ * either copied as they come, deferred to the end of their row or column, or
+ * the whole tile row or column is read into registers before it is written.
+ * A square tile can instead be transposed through the upper-right quadrant of
+ * its B tile, which is how the 8x8 tiles of 64x64 avoid the conflicts between
+ * their halves. Each candidate is run on the linked cache model of csim (see
+ * csim.h), and the best one is written as a function for trans.c. The misses
+ * are those of the kernel alone, with A and B laid out as in tracegen;
+ * test-trans counts a few more for its own accesses around the call.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "csim.h"
+
+enum { ORDER_ROWS, ORDER_COLS };
+enum { DIAG_NONE, DIAG_DEFER, DIAG_REGISTERS };
+
+/* A kernel of the search space, and its statistics. */
+typedef struct {
+    int rows;      // Height of a tile of A.
+    int cols;      // Width of a tile of A.
+    int order;     // Order of the tiles.
+    int inner;     // Order of the elements within a tile.
+    int diagonal;  // Handling of the diagonal, or of the tile rows.
+    bool buffered; // Are full square tiles transposed through B?
+    int registers; // Temporaries t0, t1, ... the kernel needs.
+    int locals;    // Local variables the kernel needs.
+    int id;        // Position in the search space.
+    int hits;      // The number of hits.
+    int misses;    // The number of misses.
+    int evictions; // The number of evictions.
+} candidate_t;
+
+static const char usage[] =
+    "Usage: %s [-h] -M <cols> -N <rows> [-s <s>] [-E <E>] [-b <b>]\n"
+    "          [-l <locals>] [-n <count>] [-f <name>] [-o <file>]\n"
+    "Options:\n"
+    "   -h             Display this usage info and quit.\n"
+    "   -M <cols>      Number of columns of A, as for test-trans.\n"
+    "   -N <rows>      Number of rows of A, as for test-trans.\n"
+    "   -s <s>         Number of set index bits (default 5).\n"
+    "   -E <E>         Number of lines per set (default 1).\n"
+    "   -b <b>         Number of block offset bits (default 5).\n"
+    "   -l <locals>    Local variables a kernel may use, or 0 for any\n"
+    "                  (default 12, as the lab allows).\n"
+    "   -n <count>     Number of best candidates to report (default 10).\n"
+    "   -f <name>      Name of the kernel written out (default tuned).\n"
+    "   -o <file>      File to write the kernel into (default stdout).\n";
+
+static const char *orderNames[] = {"rows", "cols"};
+static const char *diagonalNames[] = {"none", "defer", "registers"};
+
+/* Tile dimensions that are searched */
+static const int tileSizes[] = {1,  2,  3,  4,  5,  6,  7,  8,
+                                10, 12, 14, 16, 20, 24, 28, 32};
+static const int tileSizeCount = sizeof(tileSizes) / sizeof(tileSizes[0]);
+
+static int M = 0;             // The number of columns of A.
+static int N = 0;             // The number of rows of A.
+static int *A = NULL;         // The matrix to transpose, N x M.
+static int *B = NULL;         // The transposed matrix, M x N.
+static uint64_t aBase = 0;    // Simulated address of A.
+static uint64_t bBase = 0;    // Simulated address of B.
+static FILE *outfile = NULL;  // The file to write the kernel into.
+static int temps[64];         // Registers of a candidate.
+
+static int getArg(char arg[], char prog[]);
+static int enumerate(candidate_t **dst, int maxLocals);
+static void addCandidate(candidate_t **dst, int *count, candidate_t c,
+                         int maxLocals);
+static void evaluate(candidate_t *c, int s, int E, int b);
+static void runTile(candidate_t *c, int ib, int jb);
+static void runPlainTile(candidate_t *c, int ib, int jb);
+static void runBufferedTile(int size, int ib, int jb);
+static inline int load(int i, int j);
+static inline int loadB(int j, int i);
+static inline void store(int j, int i, int value);
+static int compareCandidates(const void *a, const void *b);
+static void describe(candidate_t *c, char buf[], size_t size);
+static void writeKernel(candidate_t *c, char name[]);
+static void writePlainTile(candidate_t *c, int depth);
+static void writeBufferedTile(int size, int depth);
+static void line(int depth, const char *format, ...);
+
+int main(int argc, char *argv[]) {
+    int ch, s = 5, E = 1, b = 5, maxLocals = 12, best = 10;
+    char *name = "tuned";
+    char text[128];
+    candidate_t *candidates;
+    struct timespec start, end;
+
+    outfile = stdout;
+
+    while ((ch = getopt(argc, argv, "hM:N:s:E:b:l:n:f:o:")) != -1) {
+        switch (ch) {
+        case 'h':
+            printf(usage, argv[0]);
+            exit(0);
+        case 'M':
+            M = getArg("M", argv[0]);
+            break;
+        case 'N':
+            N = getArg("N", argv[0]);
+            break;
+        case 's':
+            s = getArg("s", argv[0]);
+            break;
+        case 'E':
+            E = getArg("E", argv[0]);
+            break;
+        case 'b':
+            b = getArg("b", argv[0]);
+            break;
+        case 'l':
+            maxLocals = getArg("l", argv[0]);
+            break;
+        case 'n':
+            best = getArg("n", argv[0]);
+            break;
+        case 'f':
+            name = optarg;
+            break;
+        case 'o':
+            if ((outfile = fopen(optarg, "w")) == NULL) {
+                printf("Error: failed to open file %s\n", optarg);
+                exit(-1);
+            }
+
+            break;
+        default:
+            printf(usage, argv[0]);
+            exit(-1);
+        }
+    }
+
+    if (M == 0 || N == 0 || E == 0) {
+        printf("Error: missing required argument\n");
+        printf(usage, argv[0]);
+        exit(-1);
+    }
+
+    A = (int *) malloc((size_t) M * N * sizeof(int));
+    B = (int *) malloc((size_t) M * N * sizeof(int));
+
+    if (A == NULL || B == NULL) {
+        printf("Error: allocation failed\n");
+        exit(-1);
+    }
+
+    for (int i = 0; i < M * N; i++)
+        A[i] = i;
+
+    /* B starts on the page after A, as tracegen puts each matrix on pages of
+     * its own, so that the two are aligned alike in the cache. */
+    bBase = ((uint64_t) M * N * sizeof(int) + 0xfff) & ~(uint64_t) 0xfff;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int count = enumerate(&candidates, maxLocals);
+
+    for (int i = 0; i < count; i++)
+        evaluate(&candidates[i], s, E, b);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    qsort(candidates, count, sizeof(candidate_t), compareCandidates);
+
+    /* The report goes to stdout, after the kernel if that goes there too. */
+    if (count > 0)
+        writeKernel(&candidates[0], name);
+
+    if (outfile != stdout && fclose(outfile) == EOF) {
+        printf("Error: failed to close the file\n");
+        exit(-1);
+    }
+
+    printf("candidates:%d seconds:%.2f (s=%d, E=%d, b=%d, %dx%d)\n", count,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+           s, E, b, M, N);
+
+    for (int i = 0; i < count && i < best; i++) {
+        describe(&candidates[i], text, sizeof(text));
+        printf("%3d. hits:%d misses:%d evictions:%d locals:%d  %s\n", i + 1,
+               candidates[i].hits, candidates[i].misses,
+               candidates[i].evictions, candidates[i].locals, text);
+    }
+
+    free(candidates);
+    free(A);
+    free(B);
+    return 0;
+}
+
+/* Parses a command-line integer argument and exit if the argument is
+ * ill-formed. `arg` is the name of the command-line argument, and `prog` is the
+ * program name. The argument must be a non-negative integer. */
+static int getArg(char arg[], char prog[]) {
+    char *end;
+    long value = strtol(optarg, &end, 10);
+
+    if (*optarg == '\0' || *end != '\0' || value < 0 || value > 1 << 20) {
+        printf("Error: invalid argument %s\n", arg);
+        printf(usage, prog);
+        exit(-1);
+    }
+
+    return (int) value;
+}
+
+/* Store the candidates of the search space that need at most `maxLocals` local
+ * variables, or any number if 0, into a new array at `dst`. Returns their
+ * number. */
+static int enumerate(candidate_t **dst, int maxLocals) {
+    int count = 0;
+
+    *dst = NULL;
+
+    for (int r = 0; r < tileSizeCount; r++) {
+        for (int c = 0; c < tileSizeCount; c++) {
+            for (int order = ORDER_ROWS; order <= ORDER_COLS; order++) {
+                for (int inner = ORDER_ROWS; inner <= ORDER_COLS; inner++) {
+                    for (int d = DIAG_NONE; d <= DIAG_REGISTERS; d++) {
+                        candidate_t cand = {.rows = tileSizes[r],
+                                            .cols = tileSizes[c],
+                                            .order = order,
+                                            .inner = inner,
+                                            .diagonal = d};
+
+                        addCandidate(dst, &count, cand, maxLocals);
+
+                        if (r == c && tileSizes[r] % 2 == 0) {
+                            cand.buffered = true;
+                            addCandidate(dst, &count, cand, maxLocals);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return count;
+}
+
+/* Append `c` to the array at `dst` of `count` candidates, if it needs at most
+ * `maxLocals` local variables. Besides its registers and the deferred diagonal
+ * element, a kernel has the four loop variables ib, jb, i and j. */
+static void addCandidate(candidate_t **dst, int *count, candidate_t c,
+                         int maxLocals) {
+    if (c.diagonal == DIAG_REGISTERS)
+        c.registers = c.inner == ORDER_ROWS ? c.cols : c.rows;
+    if (c.buffered && c.rows > c.registers)
+        c.registers = c.rows;
+
+    c.locals = 4 + c.registers + (c.diagonal == DIAG_DEFER);
+    c.id = *count;
+
+    if (maxLocals != 0 && c.locals > maxLocals)
+        return;
+
+    if ((*count & (*count - 1)) == 0) {
+        *dst = (candidate_t *) realloc(*dst, (*count == 0 ? 1 : *count * 2) *
+                                                 sizeof(candidate_t));
+
+        if (*dst == NULL) {
+            printf("Error: allocation failed\n");
+            exit(-1);
+        }
+    }
+
+    (*dst)[(*count)++] = c;
+}
+
+/* Run the kernel `c` on a cache of 2^s sets of E lines of 2^b bytes, and
+ * store its statistics. Exits the program if it does not transpose A, which
+ * would be a bug of the tuner. */
+static void evaluate(candidate_t *c, int s, int E, int b) {
+    csimBegin(s, E, b);
+
+    if (c->order == ORDER_ROWS) {
+        for (int ib = 0; ib < N; ib += c->rows)
+            for (int jb = 0; jb < M; jb += c->cols)
+                runTile(c, ib, jb);
+    } else {
+        for (int jb = 0; jb < M; jb += c->cols)
+            for (int ib = 0; ib < N; ib += c->rows)
+                runTile(c, ib, jb);
+    }
+
+    csimEnd(&c->hits, &c->misses, &c->evictions);
+
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < M; j++) {
+            if (B[j * N + i] != A[i * M + j]) {
+                printf("Error: candidate does not transpose\n");
+                exit(-1);
+            }
+        }
+    }
+
+    memset(B, 0, (size_t) M * N * sizeof(int));
+}
+
+/* Transpose the tile of A at row `ib` and column `jb` with the kernel `c`. */
+static void runTile(candidate_t *c, int ib, int jb) {
+    if (c->buffered && ib + c->rows <= N && jb + c->cols <= M)
+        runBufferedTile(c->rows, ib, jb);
+    else
+        runPlainTile(c, ib, jb);
+}
+
+/* Transpose the tile of A at row `ib` and column `jb` element by element, row
+ * by row or column by column, as `c` tells. */
+static void runPlainTile(candidate_t *c, int ib, int jb) {
+    int iend = ib + c->rows < N ? ib + c->rows : N;
+    int jend = jb + c->cols < M ? jb + c->cols : M;
+    int temp = 0;
+
+    if (c->inner == ORDER_ROWS) {
+        for (int i = ib; i < iend; i++) {
+            if (c->diagonal == DIAG_REGISTERS) {
+                for (int j = jb; j < jend; j++)
+                    temps[j - jb] = load(i, j);
+                for (int j = jb; j < jend; j++)
+                    store(j, i, temps[j - jb]);
+                continue;
+            }
+
+            for (int j = jb; j < jend; j++) {
+                if (c->diagonal == DIAG_DEFER && i == j)
+                    temp = load(i, j);
+                else
+                    store(j, i, load(i, j));
+            }
+
+            if (c->diagonal == DIAG_DEFER && jb <= i && i < jend)
+                store(i, i, temp);
+        }
+    } else {
+        for (int j = jb; j < jend; j++) {
+            if (c->diagonal == DIAG_REGISTERS) {
+                for (int i = ib; i < iend; i++)
+                    temps[i - ib] = load(i, j);
+                for (int i = ib; i < iend; i++)
+                    store(j, i, temps[i - ib]);
+                continue;
+            }
+
+            for (int i = ib; i < iend; i++) {
+                if (c->diagonal == DIAG_DEFER && i == j)
+                    temp = load(i, j);
+                else
+                    store(j, i, load(i, j));
+            }
+
+            if (c->diagonal == DIAG_DEFER && ib <= j && j < iend)
+                store(j, j, temp);
+        }
+    }
+}
+
+/* Transpose the full `size` x `size` tile of A at row `ib` and column `jb`
+ * through the upper-right quadrant of its B tile. The upper half of A goes to
+ * the upper half of B, its right quadrant parked upper-right; then the parked
+ * quadrant is moved down-left while the lower-left quadrant of A takes its
+ * place, a row of B at a time; and the lower-right quadrant goes last. */
+static void runBufferedTile(int size, int ib, int jb) {
+    int half = size / 2;
+
+    for (int i = 0; i < half; i++) {
+        for (int x = 0; x < size; x++)
+            temps[x] = load(ib + i, jb + x);
+        for (int x = 0; x < half; x++)
+            store(jb + x, ib + i, temps[x]);
+        for (int x = 0; x < half; x++)
+            store(jb + x, ib + half + i, temps[half + x]);
+    }
+
+    for (int i = 0; i < half; i++) {
+        for (int x = 0; x < half; x++)
+            temps[x] = loadB(jb + i, ib + half + x);
+        for (int x = 0; x < half; x++)
+            temps[half + x] = load(ib + half + x, jb + i);
+        for (int x = 0; x < half; x++)
+            store(jb + i, ib + half + x, temps[half + x]);
+        for (int x = 0; x < half; x++)
+            store(jb + half + i, ib + x, temps[x]);
+    }
+
+    for (int i = half; i < size; i++) {
+        for (int x = 0; x < half; x++)
+            temps[x] = load(ib + i, jb + half + x);
+        for (int x = 0; x < half; x++)
+            store(jb + half + x, ib + i, temps[x]);
+    }
+}
+
+/* Return A[i][j], simulating the load. */
+static inline int load(int i, int j) {
+    csimAccess('L', aBase + ((uint64_t) i * M + j) * sizeof(int), sizeof(int));
+    return A[i * M + j];
+}
+
+/* Return B[j][i], simulating the load. */
+static inline int loadB(int j, int i) {
+    csimAccess('L', bBase + ((uint64_t) j * N + i) * sizeof(int), sizeof(int));
+    return B[j * N + i];
+}
+
+/* Set B[j][i] to `value`, simulating the store. */
+static inline void store(int j, int i, int value) {
+    csimAccess('S', bBase + ((uint64_t) j * N + i) * sizeof(int), sizeof(int));
+    B[j * N + i] = value;
+}
+
+/* Order candidates by misses, then by the local variables they need, keeping
+ * the order of the search space otherwise. */
+static int compareCandidates(const void *a, const void *b) {
+    const candidate_t *x = a, *y = b;
+
+    if (x->misses != y->misses)
+        return x->misses < y->misses ? -1 : 1;
+    if (x->locals != y->locals)
+        return x->locals < y->locals ? -1 : 1;
+    return x->id - y->id;
+}
+
+/* Write a description of the kernel `c` into `buf` of `size` bytes. */
+static void describe(candidate_t *c, char buf[], size_t size) {
+    snprintf(buf, size, "%dx%d tiles, %s/%s, diagonal %s%s", c->rows, c->cols,
+             orderNames[c->order], orderNames[c->inner],
+             diagonalNames[c->diagonal], c->buffered ? ", buffered" : "");
+}
+
+/* Write the kernel `c` as a transpose function `name` of trans.c, with its
+ * description string. */
+static void writeKernel(candidate_t *c, char name[]) {
+    char text[128];
+    int depth = 3;
+    bool registers = c->diagonal == DIAG_REGISTERS;
+
+    describe(c, text, sizeof(text));
+
+    line(0, "/*");
+    line(0, " * %s - Transpose of %d misses on %dx%d, found by transtune", name,
+         c->misses, M, N);
+    line(0, " *     (%s). Register it with", text);
+    line(0, " *     registerTransFunction(%s, %s_desc).", name, name);
+    line(0, " */");
+    line(0, "char %s_desc[] = \"Tuned: %s\";", name, text);
+    line(0, "void %s(int M, int N, int A[N][M], int B[M][N]) {", name);
+    /* Plain tiles through registers only loop over one of i and j. */
+    fprintf(outfile, "    int ib, jb");
+    if (!registers || c->inner == ORDER_ROWS || c->buffered)
+        fprintf(outfile, ", i");
+    if (!registers || c->inner == ORDER_COLS)
+        fprintf(outfile, ", j");
+    if (c->diagonal == DIAG_DEFER)
+        fprintf(outfile, ", temp");
+    for (int x = 0; x < c->registers; x++)
+        fprintf(outfile, ", t%d", x);
+    fprintf(outfile, ";\n\n");
+
+    if (c->order == ORDER_ROWS) {
+        line(1, "for (ib = 0; ib < N; ib += %d) {", c->rows);
+        line(2, "for (jb = 0; jb < M; jb += %d) {", c->cols);
+    } else {
+        line(1, "for (jb = 0; jb < M; jb += %d) {", c->cols);
+        line(2, "for (ib = 0; ib < N; ib += %d) {", c->rows);
+    }
+
+    if (c->buffered) {
+        line(3, "if (ib + %d <= N && jb + %d <= M) {", c->rows, c->cols);
+        writeBufferedTile(c->rows, 4);
+        line(3, "} else {");
+        depth = 4;
+    }
+
+    writePlainTile(c, depth);
+
+    if (c->buffered)
+        line(3, "}");
+
+    line(2, "}");
+    line(1, "}");
+    line(0, "}");
+}
+
+/* Write the plain tile loops of the kernel `c` at indentation `depth`, doing
+ * exactly the accesses of runPlainTile(). */
+static void writePlainTile(candidate_t *c, int depth) {
+    bool rows = c->inner == ORDER_ROWS;
+    int count = rows ? c->cols : c->rows;
+    const char *outer = rows ? "i" : "j", *inner = rows ? "j" : "i";
+    const char *start = rows ? "ib" : "jb", *bound = rows ? "N" : "M";
+    const char *innerStart = rows ? "jb" : "ib", *innerBound = rows ? "M" : "N";
+    int outerSize = rows ? c->rows : c->cols;
+
+    line(depth, "for (%s = %s; %s < %s + %d && %s < %s; %s++) {", outer, start,
+         outer, start, outerSize, outer, bound, outer);
+
+    if (c->diagonal == DIAG_REGISTERS) {
+        for (int x = 0; x < count; x++) {
+            char index[32];
+
+            snprintf(index, sizeof(index), x == 0 ? "%s" : "%s + %d",
+                     innerStart, x);
+            if (x > 0)
+                line(depth + 1, "if (%s + %d < %s)", innerStart, x,
+                     innerBound);
+            line(depth + 1 + (x > 0), "t%d = A[%s][%s];", x,
+                 rows ? "i" : index, rows ? index : "j");
+        }
+
+        for (int x = 0; x < count; x++) {
+            char index[32];
+
+            snprintf(index, sizeof(index), x == 0 ? "%s" : "%s + %d",
+                     innerStart, x);
+            if (x > 0)
+                line(depth + 1, "if (%s + %d < %s)", innerStart, x,
+                     innerBound);
+            line(depth + 1 + (x > 0), "B[%s][%s] = t%d;", rows ? index : "j",
+                 rows ? "i" : index, x);
+        }
+    } else {
+        line(depth + 1, "for (%s = %s; %s < %s + %d && %s < %s; %s++) {",
+             inner, innerStart, inner, innerStart, count, inner, innerBound,
+             inner);
+
+        if (c->diagonal == DIAG_DEFER) {
+            line(depth + 2, "if (i == j)");
+            line(depth + 3, "temp = A[i][j];");
+            line(depth + 2, "else");
+            line(depth + 3, "B[j][i] = A[i][j];");
+        } else {
+            line(depth + 2, "B[j][i] = A[i][j];");
+        }
+
+        line(depth + 1, "}");
+
+        if (c->diagonal == DIAG_DEFER) {
+            line(0, "");
+            line(depth + 1, "if (%s <= %s && %s < %s + %d && %s < %s)",
+                 innerStart, outer, outer, innerStart, count, outer,
+                 innerBound);
+            line(depth + 2, "B[%s][%s] = temp;", outer, outer);
+        }
+    }
+
+    line(depth, "}");
+}
+
+/* Write the loops of a buffered `size` x `size` tile at indentation `depth`,
+ * doing exactly the accesses of runBufferedTile(). */
+static void writeBufferedTile(int size, int depth) {
+    int half = size / 2;
+
+    line(depth, "for (i = 0; i < %d; i++) {", half);
+    for (int x = 0; x < size; x++)
+        line(depth + 1, "t%d = A[ib + i][jb + %d];", x, x);
+    for (int x = 0; x < half; x++)
+        line(depth + 1, "B[jb + %d][ib + i] = t%d;", x, x);
+    for (int x = 0; x < half; x++)
+        line(depth + 1, "B[jb + %d][ib + %d + i] = t%d;", x, half, half + x);
+    line(depth, "}");
+    line(0, "");
+
+    line(depth, "for (i = 0; i < %d; i++) {", half);
+    for (int x = 0; x < half; x++)
+        line(depth + 1, "t%d = B[jb + i][ib + %d];", x, half + x);
+    for (int x = 0; x < half; x++)
+        line(depth + 1, "t%d = A[ib + %d][jb + i];", half + x, half + x);
+    for (int x = 0; x < half; x++)
+        line(depth + 1, "B[jb + i][ib + %d] = t%d;", half + x, half + x);
+    for (int x = 0; x < half; x++)
+        line(depth + 1, "B[jb + %d + i][ib + %d] = t%d;", half, x, x);
+    line(depth, "}");
+    line(0, "");
+
+    line(depth, "for (i = %d; i < %d; i++) {", half, size);
+    for (int x = 0; x < half; x++)
+        line(depth + 1, "t%d = A[ib + i][jb + %d];", x, half + x);
+    for (int x = 0; x < half; x++)
+        line(depth + 1, "B[jb + %d][ib + i] = t%d;", half + x, x);
+    line(depth, "}");
+}
+
+/* Write a line of the kernel, indented by `depth` levels. */
+static void line(int depth, const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    if (*format != '\0')
+        fprintf(outfile, "%*s", depth * 4, "");
+    vfprintf(outfile, format, args);
+    fprintf(outfile, "\n");
+    va_end(args);
+}